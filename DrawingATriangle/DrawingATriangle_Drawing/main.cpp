@@ -8,31 +8,2505 @@
 #include <sstream>      // Enables creating std::stringstream error messages for exceptions
 #include <optional>     // A wrapper that contains no value until you assign something it.
 #include <set>          // Allows creation of sets, ie of all unique queue families.
+#include <map>          // Used to look up cached pipeline layouts
+#include <unordered_map> // Used to look up cached pipelines
 #include <cstdlib>      // Provides the EXIT_SUCCESS and EXIT_FAILURE macros
 #include <cstdint>      // Necessary for UINT32_MAX
 #include <algorithm>    // Allows use of min and max functions
 #include <fstream>      // Used for loading in binary SPIR-V data
+#include <cstring>      // Provides strcmp (not pulled in transitively by every standard library)
+#include <string>       // Used for parsing command line arguments
+#include <chrono>       // Used for timing frames in benchmark mode
+#include <iomanip>      // Used for formatting the benchmark report
+#include <cmath>        // Provides std::ceil for computing percentiles
+#include <filesystem>   // Used to atomically replace the pipeline cache file
+#include <deque>        // Holds objects waiting to be destroyed once the GPU is done with them
+#include <functional>   // Used to store how to destroy those objects
+#include <thread>       // These 4 headers are for the worker threads that record command buffers
+#include <mutex>
+#include <condition_variable>
+#include <memory>
+#include <atomic>       // Used by the profiler's per-thread event buffers
+#include <future>       // Used to rebuild the pipeline in the background when shaders change
+
+// Build with ENABLE_SHADERC defined (and link shaderc_combined, from the Vulkan SDK or the libshaderc-dev package) to be able to compile the GLSL shaders at runtime with --compile-shaders.
+#ifdef ENABLE_SHADERC
+#include <shaderc/shaderc.h>
+/* Identifies the shaderc/glslang the shader cache entries were compiled with. The build should define it from the
+toolchain, ie -DSHADERC_VERSION="\"$(glslc --version | head -n 1)\"". Without it the build time is used, which
+is safe with the static shaderc_combined (a new shaderc means a new build) but throws the cache away on every rebuild.*/
+#ifndef SHADERC_VERSION
+#define SHADERC_VERSION "build " __DATE__ " " __TIME__
+#endif
+#endif
+
+// Used to memory-map the shader pack.
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX            // Otherwise windows.h defines min and max macros, which break std::min and std::max
+#include <windows.h>
+#else
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+#ifdef __linux__
+#include <sys/inotify.h>    // Used to watch the shaders directory for changes
+#endif
+
+
+const uint32_t WIDTH = 800;
+const uint32_t HEIGHT = 600;
+// How many frames can be processed in parallel by the GPU at once, unless changed with --frames-in-flight.
+const uint32_t DEFAULT_FRAMES_IN_FLIGHT = 2;
+// Upper limit for --frames-in-flight. Past a few frames, the extra queued work only adds latency.
+const uint32_t MAX_FRAMES_IN_FLIGHT = 8;
+// Upper limit when frames in flight are auto-tuned.
+const uint32_t MAX_ADAPTIVE_FRAMES_IN_FLIGHT = 4;
+
+// Add two configuration variables to specify the layers to enable...
+const std::vector<const char*> validationLayers = {
+    "VK_LAYER_KHRONOS_validation"
+};
+// ... and whether to enable them.
+#ifdef NDEBUG
+const bool enableValidationLayers = false;
+#else
+const bool enableValidationLayers = true;
+#endif
+
+// Define the required physical device extensions.
+const std::vector<const char*> deviceExtensions = {
+    VK_KHR_SWAPCHAIN_EXTENSION_NAME
+};
+
+// Device extensions VK_EXT_shader_object depends on. All of them are core in newer Vulkan versions, but the app asks for 1.0.
+const std::vector<const char*> shaderObjectDependencies = {
+    VK_KHR_DYNAMIC_RENDERING_EXTENSION_NAME,
+    VK_KHR_DEPTH_STENCIL_RESOLVE_EXTENSION_NAME,
+    VK_KHR_CREATE_RENDERPASS_2_EXTENSION_NAME,
+    VK_KHR_MULTIVIEW_EXTENSION_NAME,
+    VK_KHR_MAINTENANCE_2_EXTENSION_NAME
+};
+
+/* One vertex of the vertex buffer. The members are the vertex shader's inputs in location order, tightly packed, since
+that's how the vertex input state is laid out from the shader's reflection (see describeVertexInput()).*/
+struct Vertex {
+    float position[2];  // location 0
+    float color[3];     // location 1
+};
+
+// The triangle, now as GPU-resident geometry instead of arrays hardcoded in the vertex shader.
+const std::vector<Vertex> vertices = {
+    { {  0.0f, -0.5f }, { 1.0f, 0.0f, 0.0f } },  // Top vertex (v0) is red
+    { {  0.5f,  0.5f }, { 0.0f, 1.0f, 0.0f } },  // Bottom right vertex (v1) is green
+    { { -0.5f,  0.5f }, { 0.0f, 0.0f, 1.0f } }   // Bottom left vertex (v2) is blue
+};
+// Which vertices make up each triangle. 16 bit indices are enough for up to 65535 unique vertices.
+const std::vector<uint16_t> indices = {
+    0, 1, 2
+};
+
+// How many offscreen images to render into in headless mode. Mirrors the minImageCount + 1 that is usually requested for the swap chain.
+const uint32_t HEADLESS_IMAGE_COUNT = 3;
+// The format of the offscreen images. Matches the preferred swap chain surface format so both paths exercise the same render pass & pipeline.
+const VkFormat HEADLESS_IMAGE_FORMAT = VK_FORMAT_B8G8R8A8_SRGB;
+
+// Build with EMBEDDED_SPIRV defined (ie -DEMBEDDED_SPIRV, or in Visual Studio's Preprocessor Definitions) to compile the shaders into the executable instead of loading shaders/*.spv at startup. No file I/O, no copies, and it doesn't matter what the working directory is.
+// The .inc files are the SPIR-V words as comma separated numbers, written by shaders/compile.bat (glslc -mfmt=num). Being uint32_t arrays, they're already aligned the way VkShaderModuleCreateInfo::pCode needs.
+#ifdef EMBEDDED_SPIRV
+constexpr uint32_t EMBEDDED_VERT_SPIRV[] = {
+#include "shaders/vert.spv.inc"
+};
+constexpr uint32_t EMBEDDED_FRAG_SPIRV[] = {
+#include "shaders/frag.spv.inc"
+};
+#endif
+
+// A shader the pipeline uses. name is both the GLSL source in shaders/ and the shader's name in a shader pack, spvPath is the SPIR-V compiled by compile.bat.
+struct ShaderSource {
+    const char* name;
+    const char* spvPath;
+    VkShaderStageFlagBits stage;
+};
+const ShaderSource VERTEX_SHADER = { "shader.vert", "shaders/vert.spv", VK_SHADER_STAGE_VERTEX_BIT };
+const ShaderSource FRAGMENT_SHADER = { "shader.frag", "shaders/frag.spv", VK_SHADER_STAGE_FRAGMENT_BIT };
+
+
+// Runtime options for the application. They are filled in from the command line in main().
+struct AppSettings {
+    // Render into device-local offscreen VkImages instead of a window. No GLFW window, surface or swap chain is created, so this works on machines without a display (ie lavapipe).
+    bool headless = false;
+    // There is no window to close in headless mode, so render this many frames and then exit.
+    uint32_t headlessFrameCount = 1000;
+
+    // Render warmupFrames frames that aren't measured (so pipeline creation, first use of memory, driver caches etc. don't skew the results), then benchmarkFrames measured frames, and report the frame timings as JSON.
+    bool benchmark = false;
+    uint32_t warmupFrames = 100;
+    uint32_t benchmarkFrames = 1000;
+    // Where to write the JSON report. Empty means print it to stdout.
+    std::string benchmarkOutputPath;
+
+    // How many frames the CPU can get ahead of the GPU. More frames keeps the GPU busier (throughput), fewer gives lower input-to-display latency.
+    uint32_t framesInFlight = DEFAULT_FRAMES_IN_FLIGHT;
+    // Pick frames in flight at runtime, based on how long the CPU ends up waiting on the GPU (see FramesInFlightTuner).
+    bool adaptiveFramesInFlight = false;
+
+    // Pace frames with a single VK_KHR_timeline_semaphore counter instead of per-frame fences. Falls back to fences if the device doesn't support it.
+    bool timelineSemaphores = false;
+    // Build pipelines from VK_EXT_graphics_pipeline_library parts: fast-link them when they're first needed, and swap in a link time optimized version once it's built in the background. Falls back to whole pipelines if the device doesn't support it.
+    bool pipelineLibraries = false;
+    // Draw with VK_EXT_shader_object shaders and fully dynamic state instead of a VkPipeline, so no pipeline is ever compiled. Falls back to pipelines if the device doesn't support it.
+    bool shaderObjects = false;
+
+    // File the VkPipelineCache is loaded from at startup and saved to at cleanup, so pipelines don't have to be compiled from scratch on every launch. Empty disables the on-disk cache.
+    std::string pipelineCachePath = "pipeline_cache.bin";
+
+    // Number of worker threads that record the draws into secondary command buffers. 0 records everything on the main thread, straight into the primary command buffer.
+    uint32_t recordThreads = 0;
+    // Number of draw calls recorded per frame. The scene is still the one triangle, but drawing it many times makes recording cost something.
+    uint32_t drawCount = 1;
+    // Number of worker threads that compile pipelines. 0 uses one per hardware thread.
+    uint32_t compileThreads = 0;
+
+    // Record CPU profiler zones (see PROFILE_ZONE) and write them to this file as Chrome trace JSON on exit. Empty disables the profiler.
+    std::string tracePath;
+
+    // Load the shaders from this shader pack (see ShaderPack and shaders/pack_shaders.py) instead of the loose .spv files. Empty uses the .spv files (or the embedded SPIR-V if built with EMBEDDED_SPIRV).
+    std::string shaderPackPath;
+
+    // Compile the GLSL shaders in shaders/ at startup (needs a build with ENABLE_SHADERC). Compiled SPIR-V is cached in shaderCacheDir, so unchanged shaders are only compiled once.
+    bool compileShaders = false;
+    std::string shaderCacheDir = "shader_cache";
+    // Preprocessor definitions (NAME or NAME=VALUE) to compile the shaders with.
+    std::vector<std::string> shaderDefines;
+
+    // A specialization constant value from --specialize. The value is parsed once the shader's reflection says what type the constant is.
+    struct Specialization {
+        VkShaderStageFlagBits stage;
+        uint32_t constantId;
+        std::string value;
+    };
+    std::vector<Specialization> specializations;
+
+    // Watch shaders/ and rebuild the pipeline in the background when the shaders change (Linux only). With compileShaders, the GLSL sources are watched, otherwise the .spv files.
+    bool hotReload = false;
+
+    // Print a table of how long each startup step took, sorted slowest first.
+    bool startupReport = false;
+    // Per-step time limits in milliseconds, keyed by the step's name in the table ("total" for all of startup). If any step goes over, the app exits with an error instead of rendering. Implies startupReport.
+    std::vector<std::pair<std::string, double>> startupBudgets;
+};
+
+
+// All of the CPU timing is done with a monotonic clock, so it can't jump around if the system time changes.
+using Clock = std::chrono::steady_clock;
+
+// Returns the time b/w two time points in milliseconds.
+static double elapsedMilliseconds(Clock::time_point start, Clock::time_point end) {
+    return std::chrono::duration<double, std::milli>(end - start).count();
+}
+
+// Escape text for use inside a JSON string, for text that doesn't come from this program (ie the device name the driver reports).
+static std::string escapeJson(const std::string& text) {
+    std::ostringstream escaped;
+    for (char c : text) {
+        switch (c) {
+        case '"':
+            escaped << "\\\"";
+            break;
+        case '\\':
+            escaped << "\\\\";
+            break;
+        case '\n':
+            escaped << "\\n";
+            break;
+        case '\r':
+            escaped << "\\r";
+            break;
+        case '\t':
+            escaped << "\\t";
+            break;
+        default:
+            // Other control characters have to be written as \u escapes.
+            if (static_cast<unsigned char>(c) < 0x20) {
+                escaped << "\\u" << std::hex << std::setw(4) << std::setfill('0') << static_cast<int>(c) << std::dec;
+            }
+            else {
+                escaped << c;
+            }
+        }
+    }
+    return escaped.str();
+}
+
+/* Make sure a file that was just written is on disk, not only in the OS's cache, so it can safely be renamed over
+another file: otherwise a crash right after the rename can leave an empty or partial file behind. Returns false if it
+can't be done.*/
+static bool syncFileToDisk(const std::string& path) {
+#ifdef _WIN32
+    HANDLE file = CreateFileA(path.c_str(), GENERIC_WRITE, 0, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+    if (file == INVALID_HANDLE_VALUE) {
+        return false;
+    }
+    bool synced = FlushFileBuffers(file) != 0;
+    CloseHandle(file);
+    return synced;
+#else
+    int file = ::open(path.c_str(), O_WRONLY);
+    if (file < 0) {
+        return false;
+    }
+    bool synced = fsync(file) == 0;
+    ::close(file);
+    return synced;
+#endif
+}
+
+/* Low-overhead CPU profiler. Code marks the zones it wants measured with PROFILE_ZONE("name"), and the profiler writes
+them out as Chrome trace JSON, which can be opened in chrome://tracing or https://ui.perfetto.dev.
+
+Each thread records into its own fixed-size ring buffer, so recording a zone never takes a lock or allocates: it's two
+clock reads and a store. The buffers are linked into a list with an atomic push when a thread records its first zone,
+and are never freed, so they stay readable after their thread exits. If a thread records more than RING_CAPACITY
+zones, the oldest ones are overwritten.
+
+When the profiler is disabled (the default), a zone costs one relaxed atomic load.*/
+class Profiler {
+public:
+    static void enable() {
+        enabled.store(true, std::memory_order_relaxed);
+    }
+
+    static bool isEnabled() {
+        return enabled.load(std::memory_order_relaxed);
+    }
+
+    // Name the calling thread in the trace. Call it before the thread records any zones.
+    static void setThreadName(const char* name) {
+        if (!isEnabled()) {
+            return;
+        }
+        ThreadBuffer& buffer = getThreadBuffer();
+        std::strncpy(buffer.name, name, sizeof(buffer.name) - 1);
+    }
+
+    // Record a finished zone on the calling thread. name must outlive the profiler (ie a string literal).
+    static void record(const char* name, Clock::time_point start, Clock::time_point end) {
+        ThreadBuffer& buffer = getThreadBuffer();
+        // Only this thread writes head, so a relaxed load is enough. The release store publishes the event to flushes.
+        uint64_t head = buffer.head.load(std::memory_order_relaxed);
+        Event& event = buffer.events[head % RING_CAPACITY];
+        event.name = name;
+        event.startNs = std::chrono::duration_cast<std::chrono::nanoseconds>(start - epoch).count();
+        event.durationNs = std::chrono::duration_cast<std::chrono::nanoseconds>(end - start).count();
+        buffer.head.store(head + 1, std::memory_order_release);
+    }
+
+    /* Write every thread's zones as Chrome trace JSON. This doesn't stop other threads from recording: each buffer's
+    head is read before and after copying its events, and events that may have been overwritten in between are
+    dropped. Returns false if the file can't be written.*/
+    static bool writeChromeTrace(const std::string& path) {
+        std::ofstream file(path);
+        if (!file.is_open()) {
+            return false;
+        }
+
+        file << "{\"displayTimeUnit\": \"ms\", \"traceEvents\": [\n";
+        bool first = true;
+        std::vector<Event> events;
+        for (ThreadBuffer* buffer = threadBuffers.load(std::memory_order_acquire); buffer != nullptr; buffer = buffer->next) {
+            uint64_t head = buffer->head.load(std::memory_order_acquire);
+            uint64_t tail = head > RING_CAPACITY ? head - RING_CAPACITY : 0;
+            events.clear();
+            for (uint64_t i = tail; i < head; i++) {
+                events.push_back(buffer->events[i % RING_CAPACITY]);
+            }
+            // The thread may have wrapped around onto the oldest events while they were being copied.
+            uint64_t newHead = buffer->head.load(std::memory_order_acquire);
+            size_t overwritten = static_cast<size_t>(std::min<uint64_t>(events.size(), newHead > head ? newHead - head : 0));
+
+            if (buffer->name[0] != '\0') {
+                file << (first ? "" : ",\n") << "{\"name\": \"thread_name\", \"ph\": \"M\", \"pid\": 1, \"tid\": " << buffer->threadId
+                    << ", \"args\": {\"name\": \"" << buffer->name << "\"}}";
+                first = false;
+            }
+            for (size_t i = overwritten; i < events.size(); i++) {
+                // Chrome trace timestamps are in microseconds.
+                file << (first ? "" : ",\n") << std::fixed << std::setprecision(3)
+                    << "{\"name\": \"" << events[i].name << "\", \"ph\": \"X\", \"pid\": 1, \"tid\": " << buffer->threadId
+                    << ", \"ts\": " << events[i].startNs / 1000.0 << ", \"dur\": " << events[i].durationNs / 1000.0 << "}";
+                first = false;
+            }
+        }
+        file << "\n]}\n";
+        return file.good();
+    }
+
+private:
+    // Zones kept per thread. About 1.5MB per thread that records anything.
+    static const uint64_t RING_CAPACITY = 1 << 16;
+
+    struct Event {
+        const char* name;
+        int64_t startNs;
+        int64_t durationNs;
+    };
+
+    struct ThreadBuffer {
+        uint32_t threadId = 0;
+        char name[32] = {};
+        // Total number of events ever recorded. Only the owning thread writes it.
+        std::atomic<uint64_t> head{ 0 };
+        Event events[RING_CAPACITY];
+        ThreadBuffer* next = nullptr;
+    };
+
+    // Get the calling thread's buffer, creating it and pushing it onto the list on first use.
+    static ThreadBuffer& getThreadBuffer() {
+        thread_local ThreadBuffer* threadBuffer = nullptr;
+        if (threadBuffer == nullptr) {
+            threadBuffer = new ThreadBuffer();
+            threadBuffer->threadId = nextThreadId.fetch_add(1, std::memory_order_relaxed);
+            threadBuffer->next = threadBuffers.load(std::memory_order_relaxed);
+            while (!threadBuffers.compare_exchange_weak(threadBuffer->next, threadBuffer, std::memory_order_release, std::memory_order_relaxed)) {
+            }
+        }
+        return *threadBuffer;
+    }
+
+    static inline std::atomic<bool> enabled{ false };
+    static inline std::atomic<ThreadBuffer*> threadBuffers{ nullptr };
+    static inline std::atomic<uint32_t> nextThreadId{ 1 };
+    // Trace timestamps are relative to when the program started.
+    static inline const Clock::time_point epoch = Clock::now();
+};
+
+// Records the time from its construction to the end of the enclosing scope as a profiler zone.
+class ProfileZone {
+public:
+    explicit ProfileZone(const char* name) : name(Profiler::isEnabled() ? name : nullptr) {
+        if (this->name != nullptr) {
+            start = Clock::now();
+        }
+    }
+
+    ~ProfileZone() {
+        if (name != nullptr) {
+            Profiler::record(name, start, Clock::now());
+        }
+    }
+
+    ProfileZone(const ProfileZone&) = delete;
+    ProfileZone& operator=(const ProfileZone&) = delete;
+
+private:
+    const char* name;
+    Clock::time_point start;
+};
+
+// Measure the rest of the enclosing scope as a zone called name (a string literal).
+#define PROFILE_CONCAT_INNER(a, b) a##b
+#define PROFILE_CONCAT(a, b) PROFILE_CONCAT_INNER(a, b)
+#define PROFILE_ZONE(name) ProfileZone PROFILE_CONCAT(profileZone, __LINE__)(name)
+
+// Starting value for fnv1a64().
+const uint64_t FNV1A64_OFFSET_BASIS = 0xcbf29ce484222325ull;
+
+// 64 bit FNV-1a hash. Not cryptographic, but fast, simple and good enough to tell shaders apart. Pass in a previous hash to hash several pieces of data as one.
+static uint64_t fnv1a64(const void* data, size_t size, uint64_t hash = FNV1A64_OFFSET_BASIS) {
+    const unsigned char* bytes = static_cast<const unsigned char*>(data);
+    for (size_t i = 0; i < size; i++) {
+        hash ^= bytes[i];
+        hash *= 0x100000001b3ull;
+    }
+    return hash;
+}
+
+/* A single file holding many SPIR-V shaders, written by shaders/pack_shaders.py. The whole file is memory-mapped, so
+opening it is one open + map no matter how many shaders it has, nothing is copied (pointers into the mapping go straight
+to vkCreateShaderModule), and the OS only reads the pages that are actually used and shares them between processes.
+
+Layout (little-endian): a Header, then Header::entryCount Entries sorted by name, then the SPIR-V of each entry at a
+16 byte aligned offset.*/
+class ShaderPack {
+public:
+    struct Shader {
+        const uint32_t* code;
+        // In bytes.
+        size_t codeSize;
+        VkShaderStageFlagBits stage;
+        // FNV-1a 64 of the SPIR-V.
+        uint64_t hash;
+    };
+
+    ShaderPack() = default;
+    ~ShaderPack() {
+        close();
+    }
+
+    ShaderPack(const ShaderPack&) = delete;
+    ShaderPack& operator=(const ShaderPack&) = delete;
+
+    // Map the pack and check its header and index. Throws if the file can't be mapped or isn't a valid pack.
+    void open(const std::string& path) {
+        close();
+#ifdef _WIN32
+        HANDLE file = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+        if (file == INVALID_HANDLE_VALUE) {
+            throw std::runtime_error("ERROR! Failed to open shader pack " + path);
+        }
+        LARGE_INTEGER fileSize;
+        if (GetFileSizeEx(file, &fileSize) && fileSize.QuadPart > 0) {
+            mapping = CreateFileMappingA(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+        }
+        // The mapping keeps the file open.
+        CloseHandle(file);
+        if (mapping == nullptr) {
+            throw std::runtime_error("ERROR! Failed to map shader pack " + path);
+        }
+        data = static_cast<const unsigned char*>(MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0));
+        if (data == nullptr) {
+            close();
+            throw std::runtime_error("ERROR! Failed to map shader pack " + path);
+        }
+        size = static_cast<size_t>(fileSize.QuadPart);
+#else
+        int file = ::open(path.c_str(), O_RDONLY);
+        if (file < 0) {
+            throw std::runtime_error("ERROR! Failed to open shader pack " + path);
+        }
+        struct stat fileInfo;
+        void* mapped = MAP_FAILED;
+        if (fstat(file, &fileInfo) == 0 && fileInfo.st_size > 0) {
+            mapped = mmap(nullptr, static_cast<size_t>(fileInfo.st_size), PROT_READ, MAP_SHARED, file, 0);
+        }
+        // The mapping keeps the file open.
+        ::close(file);
+        if (mapped == MAP_FAILED) {
+            throw std::runtime_error("ERROR! Failed to map shader pack " + path);
+        }
+        data = static_cast<const unsigned char*>(mapped);
+        size = static_cast<size_t>(fileInfo.st_size);
+#endif
+
+        std::string error = validate();
+        if (!error.empty()) {
+            close();
+            throw std::runtime_error("ERROR! Invalid shader pack " + path + ": " + error);
+        }
+    }
+
+    void close() {
+#ifdef _WIN32
+        if (data != nullptr) {
+            UnmapViewOfFile(data);
+        }
+        if (mapping != nullptr) {
+            CloseHandle(mapping);
+        }
+        mapping = nullptr;
+#else
+        if (data != nullptr) {
+            munmap(const_cast<unsigned char*>(data), size);
+        }
+#endif
+        data = nullptr;
+        size = 0;
+        entries = nullptr;
+        entryCount = 0;
+    }
+
+    bool isOpen() const {
+        return data != nullptr;
+    }
+
+    // Find a shader by name and check it's the stage the caller expects and that its SPIR-V matches the hash in the index. Throws if any of that fails.
+    Shader getShader(const std::string& name, VkShaderStageFlagBits expectedStage) const {
+        // The index is sorted by name, so binary search it.
+        const Entry* end = entries + entryCount;
+        const Entry* entry = std::lower_bound(entries, end, name, [](const Entry& e, const std::string& n) { return std::strncmp(e.name, n.c_str(), NAME_SIZE) < 0; });
+        if (entry == end || std::strncmp(entry->name, name.c_str(), NAME_SIZE) != 0) {
+            throw std::runtime_error("ERROR! Shader " + name + " isn't in the shader pack!");
+        }
+        if (entry->stage != static_cast<uint32_t>(expectedStage)) {
+            throw std::runtime_error("ERROR! Shader " + name + " in the shader pack is for the wrong stage!");
+        }
+
+        Shader shader;
+        shader.code = reinterpret_cast<const uint32_t*>(data + entry->offset);
+        shader.codeSize = static_cast<size_t>(entry->size);
+        shader.stage = expectedStage;
+        shader.hash = entry->hash;
+        if (fnv1a64(shader.code, shader.codeSize) != shader.hash) {
+            throw std::runtime_error("ERROR! Shader " + name + " in the shader pack is corrupt!");
+        }
+        return shader;
+    }
+
+private:
+    static const uint32_t VERSION = 1;
+    static const size_t NAME_SIZE = 64;
+
+    struct Header {
+        char magic[4];
+        uint32_t version;
+        uint32_t entryCount;
+        uint32_t reserved;
+    };
+
+    struct Entry {
+        // Zero terminated.
+        char name[NAME_SIZE];
+        // VkShaderStageFlagBits
+        uint32_t stage;
+        uint32_t reserved;
+        uint64_t hash;
+        // From the start of the file, in bytes.
+        uint64_t offset;
+        uint64_t size;
+    };
+    static_assert(sizeof(Header) == 16 && sizeof(Entry) == 96, "Shader pack structs must match pack_shaders.py");
+
+    // Check everything that getShader() relies on, so it can use the index without bounds checks. Returns an empty string if the pack is valid, otherwise the reason it isn't.
+    std::string validate() {
+        if (size < sizeof(Header)) {
+            return "file is too small";
+        }
+        const Header* header = reinterpret_cast<const Header*>(data);
+        if (std::memcmp(header->magic, "SPAK", 4) != 0) {
+            return "not a shader pack";
+        }
+        if (header->version != VERSION) {
+            return "unsupported version " + std::to_string(header->version);
+        }
+        if (header->entryCount > (size - sizeof(Header)) / sizeof(Entry)) {
+            return "index is truncated";
+        }
+
+        entries = reinterpret_cast<const Entry*>(data + sizeof(Header));
+        entryCount = header->entryCount;
+        for (uint32_t i = 0; i < entryCount; i++) {
+            const Entry& entry = entries[i];
+            if (std::memchr(entry.name, '\0', NAME_SIZE) == nullptr) {
+                return "shader name isn't terminated";
+            }
+            if (i > 0 && std::strncmp(entries[i - 1].name, entry.name, NAME_SIZE) >= 0) {
+                return "index isn't sorted by name";
+            }
+            // SPIR-V is made of 32 bit words, and pCode has to be 4 byte aligned.
+            if (entry.size == 0 || entry.size % 4 != 0 || entry.offset % 4 != 0 || entry.offset > size || entry.size > size - entry.offset) {
+                return std::string("shader ") + entry.name + " is out of bounds";
+            }
+        }
+        return "";
+    }
+
+    const unsigned char* data = nullptr;
+    size_t size = 0;
+#ifdef _WIN32
+    HANDLE mapping = nullptr;
+#endif
+    const Entry* entries = nullptr;
+    uint32_t entryCount = 0;
+};
+
+#ifdef ENABLE_SHADERC
+/* Compiles GLSL to SPIR-V in-process with shaderc, so shaders can be changed without running glslc by hand.
+
+Compiled SPIR-V is cached on disk, named after a hash of everything that affects the output: the source, the stage,
+the defines, and the compiler's identity (SHADERC_VERSION). Unchanged shaders are loaded from the cache instead of being compiled again,
+and a new compiler version or different defines never pick up stale output. #include isn't supported, since included
+files wouldn't be part of the hash.
+
+A single ShaderCompiler can be used from several threads at once.*/
+class ShaderCompiler {
+public:
+    ShaderCompiler() : compiler(shaderc_compiler_initialize()) {
+        if (compiler == nullptr) {
+            throw std::runtime_error("ERROR! Failed to initialize shaderc!");
+        }
+    }
+
+    ~ShaderCompiler() {
+        shaderc_compiler_release(compiler);
+    }
+
+    ShaderCompiler(const ShaderCompiler&) = delete;
+    ShaderCompiler& operator=(const ShaderCompiler&) = delete;
+
+    /* Compile the GLSL file at sourcePath for the given stage, or load it from cacheDir if it's been compiled before.
+    Returns the SPIR-V. cacheHit is set to whether it came from the cache. Throws if the source can't be read or
+    doesn't compile. Failing to write the cache is only a warning.*/
+    std::vector<char> compile(const std::string& sourcePath, VkShaderStageFlagBits stage, const std::vector<std::string>& defines, const std::string& cacheDir, bool& cacheHit) {
+        std::vector<char> source;
+        if (!readFile(sourcePath, source)) {
+            throw std::runtime_error("ERROR! Failed to open shader source " + sourcePath);
+        }
+
+        shaderc_shader_kind kind;
+        switch (stage) {
+        case VK_SHADER_STAGE_VERTEX_BIT:
+            kind = shaderc_glsl_vertex_shader;
+            break;
+        case VK_SHADER_STAGE_FRAGMENT_BIT:
+            kind = shaderc_glsl_fragment_shader;
+            break;
+        default:
+            throw std::runtime_error("ERROR! Can't compile shaders for this stage!");
+        }
+
+        /* Hash everything that changes the output. Each define ends with a \0 so "A", "B" and "AB" hash differently.
+        shaderc_get_spv_version() isn't used, it's the SPIR-V version shaderc targets and stays the same across
+        compiler releases, so the compiler is identified by SHADERC_VERSION instead.*/
+        uint64_t key = fnv1a64(CACHE_FORMAT, std::strlen(CACHE_FORMAT));
+        key = fnv1a64(SHADERC_VERSION, std::strlen(SHADERC_VERSION) + 1, key);
+        key = fnv1a64(&stage, sizeof(stage), key);
+        for (const auto& define : defines) {
+            key = fnv1a64(define.c_str(), define.size() + 1, key);
+        }
+        key = fnv1a64(source.data(), source.size(), key);
+
+        std::ostringstream cacheName;
+        cacheName << std::hex << std::setw(16) << std::setfill('0') << key << ".spv";
+        std::filesystem::path cachePath = std::filesystem::path(cacheDir) / cacheName.str();
+
+        std::vector<char> spirv;
+        if (!cacheDir.empty() && readFile(cachePath.string(), spirv) && isSpirv(spirv)) {
+            cacheHit = true;
+            return spirv;
+        }
+        cacheHit = false;
+
+        shaderc_compile_options_t options = shaderc_compile_options_initialize();
+        shaderc_compile_options_set_target_env(options, shaderc_target_env_vulkan, shaderc_env_version_vulkan_1_0);
+        shaderc_compile_options_set_optimization_level(options, shaderc_optimization_level_performance);
+        for (const auto& define : defines) {
+            size_t separator = define.find('=');
+            std::string name = define.substr(0, separator);
+            std::string value = separator == std::string::npos ? "" : define.substr(separator + 1);
+            shaderc_compile_options_add_macro_definition(options, name.c_str(), name.size(), value.c_str(), value.size());
+        }
+
+        shaderc_compilation_result_t result = shaderc_compile_into_spv(compiler, source.data(), source.size(), kind, sourcePath.c_str(), "main", options);
+        shaderc_compile_options_release(options);
+        if (shaderc_result_get_compilation_status(result) != shaderc_compilation_status_success) {
+            std::string error = shaderc_result_get_error_message(result);
+            shaderc_result_release(result);
+            throw std::runtime_error("ERROR! Failed to compile " + sourcePath + ":\n" + error);
+        }
+        const char* bytes = shaderc_result_get_bytes(result);
+        spirv.assign(bytes, bytes + shaderc_result_get_length(result));
+        shaderc_result_release(result);
+
+        if (!cacheDir.empty()) {
+            writeCacheFile(cachePath, spirv);
+        }
+        return spirv;
+    }
+
+private:
+    // Part of every cache key. Change it when the compile options above or the cache layout change, so old cache entries aren't used.
+    static constexpr const char* CACHE_FORMAT = "shaderc-spirv-cache-v2 vulkan1.0 O";
+
+    static bool readFile(const std::string& path, std::vector<char>& data) {
+        std::ifstream file(path, std::ios::ate | std::ios::binary);
+        if (!file.is_open()) {
+            return false;
+        }
+        data.resize(static_cast<size_t>(file.tellg()));
+        file.seekg(0);
+        file.read(data.data(), data.size());
+        return file.good();
+    }
+
+    // A truncated or otherwise broken cache file is just compiled again.
+    static bool isSpirv(const std::vector<char>& data) {
+        const uint32_t SPIRV_MAGIC = 0x07230203;
+        uint32_t magic = 0;
+        if (data.size() < 5 * sizeof(uint32_t) || data.size() % sizeof(uint32_t) != 0) {
+            return false;
+        }
+        std::memcpy(&magic, data.data(), sizeof(magic));
+        return magic == SPIRV_MAGIC;
+    }
+
+    // Write to a temporary file and rename it over the cache entry, so other processes never see a half-written file.
+    static void writeCacheFile(const std::filesystem::path& path, const std::vector<char>& data) {
+        std::error_code error;
+        std::filesystem::create_directories(path.parent_path(), error);
+        std::filesystem::path tempPath = path;
+        tempPath += ".tmp" + std::to_string(std::hash<std::thread::id>()(std::this_thread::get_id()));
+        {
+            std::ofstream file(tempPath, std::ios::binary | std::ios::trunc);
+            file.write(data.data(), data.size());
+            if (!file.good()) {
+                std::cout << "WARNING: Failed to write shader cache entry " << tempPath.string() << "\n";
+                return;
+            }
+        }
+        std::filesystem::rename(tempPath, path, error);
+        if (error) {
+            std::filesystem::remove(tempPath, error);
+            std::cout << "WARNING: Failed to write shader cache entry " << path.string() << "\n";
+        }
+    }
+
+    shaderc_compiler_t compiler;
+};
+#endif
+
+/* What a shader needs from the pipeline layout and vertex input state, read from its SPIR-V by reflectSpirv(): the
+descriptors it uses, how many bytes of push constants it reads, (for vertex shaders) its vertex inputs, and the
+specialization constants it can be compiled with.*/
+struct ShaderReflection {
+    struct DescriptorBinding {
+        uint32_t set;
+        uint32_t binding;
+        VkDescriptorType type;
+        // More than 1 for arrays of descriptors.
+        uint32_t count;
+    };
+
+    struct VertexInput {
+        uint32_t location;
+        VkFormat format;
+        // In bytes.
+        uint32_t size;
+    };
+
+    VkShaderStageFlagBits stage = VK_SHADER_STAGE_VERTEX_BIT;
+    std::vector<DescriptorBinding> descriptorBindings;
+    // Push constants are read from offset 0 up to this many bytes. 0 if the shader has no push constant block.
+    uint32_t pushConstantSize = 0;
+    // Sorted by location. Always empty for stages other than the vertex shader.
+    std::vector<VertexInput> vertexInputs;
+
+    // A layout(constant_id = N) constant. Only 32 bit ones are listed, as those are the ones SpecializationConstants can set.
+    struct SpecializationConstant {
+        enum class Type { Bool, Int, Uint, Float };
+
+        uint32_t constantId;
+        Type type;
+    };
+    // Sorted by constantId.
+    std::vector<SpecializationConstant> specializationConstants;
+};
+
+/* Reads a ShaderReflection out of a SPIR-V binary. Only the instructions that describe the shader's interface are
+parsed (entry point, decorations, types, constants and global variables), the function bodies are skipped, so this is
+a single quick pass over the words. The numbers are the opcodes/enumerants from the SPIR-V specification.*/
+class SpirvReflector {
+public:
+    // Parse the binary. Throws if it isn't valid SPIR-V or uses an interface this can't describe.
+    SpirvReflector(const uint32_t* code, size_t codeSize) {
+        size_t wordCount = codeSize / sizeof(uint32_t);
+        if (codeSize % sizeof(uint32_t) != 0 || wordCount < HEADER_WORDS || code[0] != MAGIC) {
+            throw std::runtime_error("ERROR! Can't reflect shader: not a SPIR-V binary!");
+        }
+        // The header's bound is one more than the largest id, so ids can index straight into a vector.
+        ids.resize(code[3]);
+
+        for (size_t i = HEADER_WORDS; i < wordCount; ) {
+            uint32_t instructionWords = code[i] >> 16;
+            uint32_t opcode = code[i] & 0xffff;
+            if (instructionWords == 0 || i + instructionWords > wordCount) {
+                throw std::runtime_error("ERROR! Can't reflect shader: truncated SPIR-V instruction!");
+            }
+            const uint32_t* words = code + i;
+            parseInstruction(opcode, words, instructionWords);
+            i += instructionWords;
+        }
+        if (!hasEntryPoint) {
+            throw std::runtime_error("ERROR! Can't reflect shader: no entry point!");
+        }
+    }
+
+    ShaderReflection reflect() const {
+        ShaderReflection reflection;
+        reflection.stage = stage;
+        for (const Id& variable : ids) {
+            if (variable.opcode != OP_VARIABLE) {
+                continue;
+            }
+            const Id& pointer = getId(variable.typeId);
+            if (pointer.opcode != OP_TYPE_POINTER || pointer.operands.size() < 2) {
+                throw std::runtime_error("ERROR! Can't reflect shader: variable isn't a pointer!");
+            }
+            uint32_t storageClass = variable.operands[0];
+            uint32_t typeId = pointer.operands[1];
+
+            if (storageClass == STORAGE_INPUT) {
+                // Built-ins (gl_VertexIndex, ...) are filled in by the GPU, not from vertex buffers.
+                if (stage == VK_SHADER_STAGE_VERTEX_BIT && !variable.builtIn && variable.hasLocation) {
+                    ShaderReflection::VertexInput input;
+                    input.location = variable.location;
+                    input.format = getVertexFormat(typeId, input.size);
+                    reflection.vertexInputs.push_back(input);
+                }
+            }
+            else if (storageClass == STORAGE_PUSH_CONSTANT) {
+                reflection.pushConstantSize = std::max(reflection.pushConstantSize, getTypeSize(typeId));
+            }
+            else if ((storageClass == STORAGE_UNIFORM_CONSTANT || storageClass == STORAGE_UNIFORM || storageClass == STORAGE_STORAGE_BUFFER) && variable.hasBinding) {
+                ShaderReflection::DescriptorBinding binding;
+                binding.set = variable.set;
+                binding.binding = variable.binding;
+                binding.count = 1;
+                // Arrays of resources are one binding with several descriptors.
+                while (getId(typeId).opcode == OP_TYPE_ARRAY || getId(typeId).opcode == OP_TYPE_RUNTIME_ARRAY) {
+                    if (getId(typeId).opcode == OP_TYPE_RUNTIME_ARRAY) {
+                        throw std::runtime_error("ERROR! Can't reflect shader: unsized descriptor arrays aren't supported!");
+                    }
+                    binding.count *= getArrayLength(typeId);
+                    typeId = getId(typeId).operands[0];
+                }
+                binding.type = getDescriptorType(storageClass, typeId);
+                reflection.descriptorBindings.push_back(binding);
+            }
+        }
+
+        for (const Id& constant : ids) {
+            if ((constant.opcode != OP_SPEC_CONSTANT_TRUE && constant.opcode != OP_SPEC_CONSTANT_FALSE && constant.opcode != OP_SPEC_CONSTANT) || !constant.hasSpecId) {
+                continue;
+            }
+            const Id& type = getId(constant.typeId);
+            ShaderReflection::SpecializationConstant specializationConstant;
+            specializationConstant.constantId = constant.specId;
+            if (type.opcode == OP_TYPE_BOOL) {
+                specializationConstant.type = ShaderReflection::SpecializationConstant::Type::Bool;
+            }
+            else if (type.opcode == OP_TYPE_INT && type.operands.at(0) == 32) {
+                specializationConstant.type = type.operands.at(1) != 0 ? ShaderReflection::SpecializationConstant::Type::Int : ShaderReflection::SpecializationConstant::Type::Uint;
+            }
+            else if (type.opcode == OP_TYPE_FLOAT && type.operands.at(0) == 32) {
+                specializationConstant.type = ShaderReflection::SpecializationConstant::Type::Float;
+            }
+            else {
+                continue;
+            }
+            reflection.specializationConstants.push_back(specializationConstant);
+        }
+
+        std::sort(reflection.vertexInputs.begin(), reflection.vertexInputs.end(),
+            [](const ShaderReflection::VertexInput& a, const ShaderReflection::VertexInput& b) { return a.location < b.location; });
+        std::sort(reflection.specializationConstants.begin(), reflection.specializationConstants.end(),
+            [](const ShaderReflection::SpecializationConstant& a, const ShaderReflection::SpecializationConstant& b) { return a.constantId < b.constantId; });
+        return reflection;
+    }
+
+private:
+    static const uint32_t MAGIC = 0x07230203;
+    static const size_t HEADER_WORDS = 5;
+
+    static const uint32_t OP_ENTRY_POINT = 15;
+    static const uint32_t OP_TYPE_BOOL = 20;
+    static const uint32_t OP_TYPE_INT = 21;
+    static const uint32_t OP_TYPE_FLOAT = 22;
+    static const uint32_t OP_TYPE_VECTOR = 23;
+    static const uint32_t OP_TYPE_MATRIX = 24;
+    static const uint32_t OP_TYPE_IMAGE = 25;
+    static const uint32_t OP_TYPE_SAMPLER = 26;
+    static const uint32_t OP_TYPE_SAMPLED_IMAGE = 27;
+    static const uint32_t OP_TYPE_ARRAY = 28;
+    static const uint32_t OP_TYPE_RUNTIME_ARRAY = 29;
+    static const uint32_t OP_TYPE_STRUCT = 30;
+    static const uint32_t OP_TYPE_POINTER = 32;
+    static const uint32_t OP_CONSTANT = 43;
+    static const uint32_t OP_SPEC_CONSTANT_TRUE = 48;
+    static const uint32_t OP_SPEC_CONSTANT_FALSE = 49;
+    static const uint32_t OP_SPEC_CONSTANT = 50;
+    static const uint32_t OP_VARIABLE = 59;
+    static const uint32_t OP_DECORATE = 71;
+    static const uint32_t OP_MEMBER_DECORATE = 72;
+
+    static const uint32_t DECORATION_SPEC_ID = 1;
+    static const uint32_t DECORATION_BLOCK = 2;
+    static const uint32_t DECORATION_BUFFER_BLOCK = 3;
+    static const uint32_t DECORATION_ARRAY_STRIDE = 6;
+    static const uint32_t DECORATION_MATRIX_STRIDE = 7;
+    static const uint32_t DECORATION_BUILT_IN = 11;
+    static const uint32_t DECORATION_LOCATION = 30;
+    static const uint32_t DECORATION_BINDING = 33;
+    static const uint32_t DECORATION_DESCRIPTOR_SET = 34;
+    static const uint32_t DECORATION_OFFSET = 35;
+
+    static const uint32_t STORAGE_UNIFORM_CONSTANT = 0;
+    static const uint32_t STORAGE_INPUT = 1;
+    static const uint32_t STORAGE_UNIFORM = 2;
+    static const uint32_t STORAGE_PUSH_CONSTANT = 9;
+    static const uint32_t STORAGE_STORAGE_BUFFER = 12;
+
+    static const uint32_t DIM_BUFFER = 5;
+
+    // Everything this needs to know about one id.
+    struct Id {
+        uint32_t opcode = 0;
+        // Result type of constants and variables.
+        uint32_t typeId = 0;
+        // The words after the result id.
+        std::vector<uint32_t> operands;
+
+        uint32_t set = 0;
+        uint32_t binding = 0;
+        uint32_t location = 0;
+        uint32_t arrayStride = 0;
+        uint32_t specId = 0;
+        bool hasSpecId = false;
+        bool hasBinding = false;
+        bool hasLocation = false;
+        bool builtIn = false;
+        bool block = false;
+        bool bufferBlock = false;
+
+        // Struct members, indexed by member.
+        std::vector<uint32_t> memberOffsets;
+        std::vector<uint32_t> memberMatrixStrides;
+    };
+
+    std::vector<Id> ids;
+    VkShaderStageFlagBits stage = VK_SHADER_STAGE_VERTEX_BIT;
+    bool hasEntryPoint = false;
+
+    Id& getId(uint32_t id) {
+        if (id >= ids.size()) {
+            throw std::runtime_error("ERROR! Can't reflect shader: id out of bounds!");
+        }
+        return ids[id];
+    }
+
+    const Id& getId(uint32_t id) const {
+        if (id >= ids.size()) {
+            throw std::runtime_error("ERROR! Can't reflect shader: id out of bounds!");
+        }
+        return ids[id];
+    }
+
+    void parseInstruction(uint32_t opcode, const uint32_t* words, uint32_t wordCount) {
+        switch (opcode) {
+        case OP_ENTRY_POINT: {
+            if (wordCount < 3 || hasEntryPoint) {
+                break;
+            }
+            // Execution models: 0 vertex, 1 tessellation control, 2 tessellation evaluation, 3 geometry, 4 fragment, 5 compute.
+            static const VkShaderStageFlagBits stages[] = {
+                VK_SHADER_STAGE_VERTEX_BIT, VK_SHADER_STAGE_TESSELLATION_CONTROL_BIT, VK_SHADER_STAGE_TESSELLATION_EVALUATION_BIT,
+                VK_SHADER_STAGE_GEOMETRY_BIT, VK_SHADER_STAGE_FRAGMENT_BIT, VK_SHADER_STAGE_COMPUTE_BIT
+            };
+            if (words[1] >= sizeof(stages) / sizeof(stages[0])) {
+                throw std::runtime_error("ERROR! Can't reflect shader: unsupported execution model!");
+            }
+            stage = stages[words[1]];
+            hasEntryPoint = true;
+            break;
+        }
+        case OP_DECORATE: {
+            if (wordCount < 3) {
+                break;
+            }
+            Id& target = getId(words[1]);
+            uint32_t value = wordCount > 3 ? words[3] : 0;
+            switch (words[2]) {
+            case DECORATION_SPEC_ID: target.specId = value; target.hasSpecId = true; break;
+            case DECORATION_BLOCK: target.block = true; break;
+            case DECORATION_BUFFER_BLOCK: target.bufferBlock = true; break;
+            case DECORATION_ARRAY_STRIDE: target.arrayStride = value; break;
+            case DECORATION_BUILT_IN: target.builtIn = true; break;
+            case DECORATION_LOCATION: target.location = value; target.hasLocation = true; break;
+            case DECORATION_BINDING: target.binding = value; target.hasBinding = true; break;
+            case DECORATION_DESCRIPTOR_SET: target.set = value; break;
+            }
+            break;
+        }
+        case OP_MEMBER_DECORATE: {
+            if (wordCount < 5) {
+                break;
+            }
+            Id& target = getId(words[1]);
+            uint32_t member = words[2];
+            if (words[3] == DECORATION_OFFSET) {
+                target.memberOffsets.resize(std::max<size_t>(target.memberOffsets.size(), member + 1), 0);
+                target.memberOffsets[member] = words[4];
+            }
+            else if (words[3] == DECORATION_MATRIX_STRIDE) {
+                target.memberMatrixStrides.resize(std::max<size_t>(target.memberMatrixStrides.size(), member + 1), 0);
+                target.memberMatrixStrides[member] = words[4];
+            }
+            break;
+        }
+        case OP_TYPE_BOOL:
+        case OP_TYPE_INT:
+        case OP_TYPE_FLOAT:
+        case OP_TYPE_VECTOR:
+        case OP_TYPE_MATRIX:
+        case OP_TYPE_IMAGE:
+        case OP_TYPE_SAMPLER:
+        case OP_TYPE_SAMPLED_IMAGE:
+        case OP_TYPE_ARRAY:
+        case OP_TYPE_RUNTIME_ARRAY:
+        case OP_TYPE_STRUCT:
+        case OP_TYPE_POINTER: {
+            // Types: result id, then operands.
+            if (wordCount < 2) {
+                break;
+            }
+            Id& type = getId(words[1]);
+            type.opcode = opcode;
+            type.operands.assign(words + 2, words + wordCount);
+            break;
+        }
+        case OP_CONSTANT:
+        case OP_SPEC_CONSTANT_TRUE:
+        case OP_SPEC_CONSTANT_FALSE:
+        case OP_SPEC_CONSTANT:
+        case OP_VARIABLE: {
+            // Result type, result id, then operands (OpSpecConstantTrue/False have none).
+            if (wordCount < 3) {
+                break;
+            }
+            Id& value = getId(words[2]);
+            value.opcode = opcode;
+            value.typeId = words[1];
+            value.operands.assign(words + 3, words + wordCount);
+            break;
+        }
+        }
+    }
+
+    uint32_t getArrayLength(uint32_t arrayTypeId) const {
+        // A specialization constant length counts with its default value.
+        const Id& length = getId(getId(arrayTypeId).operands.at(1));
+        if (length.opcode != OP_CONSTANT && length.opcode != OP_SPEC_CONSTANT) {
+            throw std::runtime_error("ERROR! Can't reflect shader: array length isn't a constant!");
+        }
+        return length.operands.at(0);
+    }
+
+    // Size in bytes of a type in a push constant (or other explicitly laid out) block.
+    uint32_t getTypeSize(uint32_t typeId, uint32_t matrixStride = 0) const {
+        const Id& type = getId(typeId);
+        switch (type.opcode) {
+        case OP_TYPE_INT:
+        case OP_TYPE_FLOAT:
+            return type.operands.at(0) / 8;
+        case OP_TYPE_VECTOR:
+            return type.operands.at(1) * getTypeSize(type.operands.at(0));
+        case OP_TYPE_MATRIX:
+            // Columns are matrixStride apart (padded to a vec4 in std140), if the block says so.
+            return type.operands.at(1) * (matrixStride != 0 ? matrixStride : getTypeSize(type.operands.at(0)));
+        case OP_TYPE_ARRAY:
+            return getArrayLength(typeId) * (type.arrayStride != 0 ? type.arrayStride : getTypeSize(type.operands.at(0)));
+        case OP_TYPE_STRUCT: {
+            // Members can be padded, so the struct ends where its furthest member ends.
+            uint32_t size = 0;
+            uint32_t packedOffset = 0;
+            for (size_t member = 0; member < type.operands.size(); member++) {
+                uint32_t offset = member < type.memberOffsets.size() ? type.memberOffsets[member] : packedOffset;
+                uint32_t stride = member < type.memberMatrixStrides.size() ? type.memberMatrixStrides[member] : 0;
+                packedOffset = offset + getTypeSize(type.operands[member], stride);
+                size = std::max(size, packedOffset);
+            }
+            return size;
+        }
+        default:
+            throw std::runtime_error("ERROR! Can't reflect shader: unsupported type in push constant block!");
+        }
+    }
+
+    // Vertex attribute format of a 32 bit scalar or vector input, and its size in bytes.
+    VkFormat getVertexFormat(uint32_t typeId, uint32_t& size) const {
+        const Id* type = &getId(typeId);
+        uint32_t componentCount = 1;
+        if (type->opcode == OP_TYPE_VECTOR) {
+            componentCount = type->operands.at(1);
+            type = &getId(type->operands.at(0));
+        }
+        if ((type->opcode != OP_TYPE_INT && type->opcode != OP_TYPE_FLOAT) || type->operands.at(0) != 32 || componentCount < 1 || componentCount > 4) {
+            throw std::runtime_error("ERROR! Can't reflect shader: vertex inputs must be 32 bit scalars or vectors!");
+        }
+        static const VkFormat floatFormats[] = { VK_FORMAT_R32_SFLOAT, VK_FORMAT_R32G32_SFLOAT, VK_FORMAT_R32G32B32_SFLOAT, VK_FORMAT_R32G32B32A32_SFLOAT };
+        static const VkFormat intFormats[] = { VK_FORMAT_R32_SINT, VK_FORMAT_R32G32_SINT, VK_FORMAT_R32G32B32_SINT, VK_FORMAT_R32G32B32A32_SINT };
+        static const VkFormat uintFormats[] = { VK_FORMAT_R32_UINT, VK_FORMAT_R32G32_UINT, VK_FORMAT_R32G32B32_UINT, VK_FORMAT_R32G32B32A32_UINT };
+        size = componentCount * 4;
+        if (type->opcode == OP_TYPE_FLOAT) {
+            return floatFormats[componentCount - 1];
+        }
+        // OpTypeInt's second operand is its signedness.
+        return type->operands.at(1) != 0 ? intFormats[componentCount - 1] : uintFormats[componentCount - 1];
+    }
+
+    VkDescriptorType getDescriptorType(uint32_t storageClass, uint32_t typeId) const {
+        const Id& type = getId(typeId);
+        if (storageClass == STORAGE_STORAGE_BUFFER) {
+            return VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+        }
+        if (storageClass == STORAGE_UNIFORM) {
+            // Older SPIR-V marks storage buffers as BufferBlock in the Uniform storage class.
+            return type.bufferBlock ? VK_DESCRIPTOR_TYPE_STORAGE_BUFFER : VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER;
+        }
+        switch (type.opcode) {
+        case OP_TYPE_SAMPLER:
+            return VK_DESCRIPTOR_TYPE_SAMPLER;
+        case OP_TYPE_SAMPLED_IMAGE:
+            return VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+        case OP_TYPE_IMAGE: {
+            // Operands: sampled type, dim, depth, arrayed, multisampled, sampled (1 = used with a sampler, 2 = storage image).
+            bool texelBuffer = type.operands.at(1) == DIM_BUFFER;
+            bool storage = type.operands.at(5) == 2;
+            if (texelBuffer) {
+                return storage ? VK_DESCRIPTOR_TYPE_STORAGE_TEXEL_BUFFER : VK_DESCRIPTOR_TYPE_UNIFORM_TEXEL_BUFFER;
+            }
+            return storage ? VK_DESCRIPTOR_TYPE_STORAGE_IMAGE : VK_DESCRIPTOR_TYPE_SAMPLED_IMAGE;
+        }
+        default:
+            throw std::runtime_error("ERROR! Can't reflect shader: unsupported descriptor type!");
+        }
+    }
+};
+
+static ShaderReflection reflectSpirv(const uint32_t* code, size_t codeSize) {
+    return SpirvReflector(code, codeSize).reflect();
+}
+
+/* Owns the descriptor set layouts and pipeline layouts of every pipeline, and hands out the same VkPipelineLayout
+whenever the shaders need the same layout. Pipelines that share a layout can be bound one after another without
+rebinding descriptor sets, and a scene with many pipelines only has as many layouts as it has distinct interfaces.
+The layouts live until destroy(), so pipelines never destroy their own. Thread safe, as pipelines can be built on
+background threads (see the shader hot reload).*/
+class PipelineLayoutCache {
+public:
+    // A pipeline layout along with what it was made from. Shader objects take the set layouts and push constant range directly instead of a VkPipelineLayout.
+    struct Layout {
+        VkPipelineLayout pipelineLayout = VK_NULL_HANDLE;
+        std::vector<VkDescriptorSetLayout> setLayouts;
+        VkPushConstantRange pushConstants{};
+    };
+
+    // Get (or create) the pipeline layout for a pipeline made of the given shaders. Throws if they disagree about a binding.
+    VkPipelineLayout getPipelineLayout(VkDevice device, const std::vector<const ShaderReflection*>& shaders) {
+        return getLayout(device, shaders).pipelineLayout;
+    }
+
+    // Same as getPipelineLayout(), but also returns the set layouts and push constant range.
+    Layout getLayout(VkDevice device, const std::vector<const ShaderReflection*>& shaders) {
+        // Merge the bindings of all the stages, per set. A binding used by several stages is visible to all of them.
+        std::map<uint32_t, std::map<uint32_t, VkDescriptorSetLayoutBinding>> sets;
+        VkPushConstantRange pushConstants{};
+        for (const ShaderReflection* shader : shaders) {
+            for (const auto& descriptor : shader->descriptorBindings) {
+                auto inserted = sets[descriptor.set].emplace(descriptor.binding, VkDescriptorSetLayoutBinding{});
+                VkDescriptorSetLayoutBinding& binding = inserted.first->second;
+                if (inserted.second) {
+                    binding.binding = descriptor.binding;
+                    binding.descriptorType = descriptor.type;
+                    binding.descriptorCount = descriptor.count;
+                }
+                else if (binding.descriptorType != descriptor.type || binding.descriptorCount != descriptor.count) {
+                    throw std::runtime_error("ERROR! Shaders disagree about descriptor set " + std::to_string(descriptor.set) + " binding " + std::to_string(descriptor.binding) + "!");
+                }
+                binding.stageFlags |= shader->stage;
+            }
+            // One range covering every stage's push constants. Sizes must be a multiple of 4.
+            if (shader->pushConstantSize > 0) {
+                pushConstants.stageFlags |= shader->stage;
+                pushConstants.size = std::max(pushConstants.size, (shader->pushConstantSize + 3) & ~3u);
+            }
+        }
+
+        // The key spells out every set's bindings, followed by the push constant range.
+        std::vector<uint32_t> key;
+        uint32_t setCount = sets.empty() ? 0 : sets.rbegin()->first + 1;
+        std::vector<std::vector<VkDescriptorSetLayoutBinding>> setBindings(setCount);
+        for (auto& set : sets) {
+            for (auto& binding : set.second) {
+                setBindings[set.first].push_back(binding.second);
+            }
+        }
+        for (const auto& bindings : setBindings) {
+            std::vector<uint32_t> setKey = getSetLayoutKey(bindings);
+            key.push_back(static_cast<uint32_t>(setKey.size()));
+            key.insert(key.end(), setKey.begin(), setKey.end());
+        }
+        key.push_back(pushConstants.stageFlags);
+        key.push_back(pushConstants.size);
+
+        std::lock_guard<std::mutex> lock(mutex);
+        auto existing = pipelineLayouts.find(key);
+        if (existing != pipelineLayouts.end()) {
+            hitCount++;
+            return existing->second;
+        }
+
+        // Sets the shaders skip (set 1 when only set 0 and 2 are used) still need a layout, so they get an empty one.
+        Layout layout;
+        for (const auto& bindings : setBindings) {
+            layout.setLayouts.push_back(getSetLayout(device, bindings));
+        }
+        layout.pushConstants = pushConstants;
+
+        VkPipelineLayoutCreateInfo pipelineLayoutInfo{};
+        pipelineLayoutInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO;
+        pipelineLayoutInfo.setLayoutCount = static_cast<uint32_t>(layout.setLayouts.size());
+        pipelineLayoutInfo.pSetLayouts = layout.setLayouts.data();
+        pipelineLayoutInfo.pushConstantRangeCount = pushConstants.size > 0 ? 1 : 0;
+        pipelineLayoutInfo.pPushConstantRanges = &pushConstants;
+
+        if (vkCreatePipelineLayout(device, &pipelineLayoutInfo, nullptr, &layout.pipelineLayout) != VK_SUCCESS) {
+            throw std::runtime_error("ERROR! Failed to create pipeline layout!");
+        }
+        pipelineLayouts.emplace(key, layout);
+        return layout;
+    }
+
+    void destroy(VkDevice device) {
+        std::lock_guard<std::mutex> lock(mutex);
+        for (auto& pipelineLayout : pipelineLayouts) {
+            vkDestroyPipelineLayout(device, pipelineLayout.second.pipelineLayout, nullptr);
+        }
+        for (auto& setLayout : setLayouts) {
+            vkDestroyDescriptorSetLayout(device, setLayout.second, nullptr);
+        }
+        pipelineLayouts.clear();
+        setLayouts.clear();
+    }
+
+    size_t getPipelineLayoutCount() {
+        std::lock_guard<std::mutex> lock(mutex);
+        return pipelineLayouts.size();
+    }
+
+    size_t getSetLayoutCount() {
+        std::lock_guard<std::mutex> lock(mutex);
+        return setLayouts.size();
+    }
+
+    // How many times an existing pipeline layout was handed out instead of creating one.
+    uint64_t getHitCount() {
+        std::lock_guard<std::mutex> lock(mutex);
+        return hitCount;
+    }
+
+private:
+    std::mutex mutex;
+    std::map<std::vector<uint32_t>, VkDescriptorSetLayout> setLayouts;
+    std::map<std::vector<uint32_t>, Layout> pipelineLayouts;
+    uint64_t hitCount = 0;
+
+    static std::vector<uint32_t> getSetLayoutKey(const std::vector<VkDescriptorSetLayoutBinding>& bindings) {
+        std::vector<uint32_t> key;
+        for (const auto& binding : bindings) {
+            key.insert(key.end(), { binding.binding, static_cast<uint32_t>(binding.descriptorType), binding.descriptorCount, binding.stageFlags });
+        }
+        return key;
+    }
+
+    // Call with the mutex locked.
+    VkDescriptorSetLayout getSetLayout(VkDevice device, const std::vector<VkDescriptorSetLayoutBinding>& bindings) {
+        std::vector<uint32_t> key = getSetLayoutKey(bindings);
+        auto existing = setLayouts.find(key);
+        if (existing != setLayouts.end()) {
+            return existing->second;
+        }
+
+        VkDescriptorSetLayoutCreateInfo layoutInfo{};
+        layoutInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO;
+        layoutInfo.bindingCount = static_cast<uint32_t>(bindings.size());
+        layoutInfo.pBindings = bindings.data();
+
+        VkDescriptorSetLayout setLayout;
+        if (vkCreateDescriptorSetLayout(device, &layoutInfo, nullptr, &setLayout) != VK_SUCCESS) {
+            throw std::runtime_error("ERROR! Failed to create descriptor set layout!");
+        }
+        setLayouts.emplace(key, setLayout);
+        return setLayout;
+    }
+};
+
+/* Values for a shader's specialization constants (layout(constant_id = N) const ... in GLSL). They're applied when the
+pipeline is compiled, so the driver can fold them into the shader like #defines without recompiling the SPIR-V: one
+module can become several tuned variants (loop counts, feature toggles, workgroup sizes) with the branches on them
+compiled away. Constants that aren't set keep the default value from the shader, and Vulkan ignores ids the shader
+doesn't have.*/
+class SpecializationConstants {
+public:
+    // Only 32 bit values, so every constant matches the shader's type. Bools are VkBool32 in SPIR-V.
+    SpecializationConstants& set(uint32_t constantId, bool value) {
+        return setBits(constantId, value ? VK_TRUE : VK_FALSE);
+    }
+
+    SpecializationConstants& set(uint32_t constantId, int32_t value) {
+        return setBits(constantId, static_cast<uint32_t>(value));
+    }
+
+    SpecializationConstants& set(uint32_t constantId, uint32_t value) {
+        return setBits(constantId, value);
+    }
+
+    SpecializationConstants& set(uint32_t constantId, float value) {
+        uint32_t bits;
+        std::memcpy(&bits, &value, sizeof(bits));
+        return setBits(constantId, bits);
+    }
+
+    bool empty() const {
+        return values.empty();
+    }
+
+    // Fill in a VkSpecializationInfo pointing at entries and data, which have to outlive it.
+    VkSpecializationInfo getInfo(std::vector<VkSpecializationMapEntry>& entries, std::vector<uint32_t>& data) const {
+        entries.clear();
+        data.clear();
+        for (const auto& value : values) {
+            VkSpecializationMapEntry entry{};
+            entry.constantID = value.first;
+            entry.offset = static_cast<uint32_t>(data.size() * sizeof(uint32_t));
+            entry.size = sizeof(uint32_t);
+            entries.push_back(entry);
+            data.push_back(value.second);
+        }
+        VkSpecializationInfo info{};
+        info.mapEntryCount = static_cast<uint32_t>(entries.size());
+        info.pMapEntries = entries.data();
+        info.dataSize = data.size() * sizeof(uint32_t);
+        info.pData = data.data();
+        return info;
+    }
+
+    // The values are kept sorted by id, so the same set of values hashes the same no matter what order they were set in.
+    uint64_t hash(uint64_t hash = FNV1A64_OFFSET_BASIS) const {
+        for (const auto& value : values) {
+            hash = fnv1a64(&value.first, sizeof(value.first), hash);
+            hash = fnv1a64(&value.second, sizeof(value.second), hash);
+        }
+        return hash;
+    }
+
+    bool operator==(const SpecializationConstants& other) const {
+        return values == other.values;
+    }
+
+private:
+    // Constant id to the value's bits.
+    std::map<uint32_t, uint32_t> values;
+
+    SpecializationConstants& setBits(uint32_t constantId, uint32_t bits) {
+        values[constantId] = bits;
+        return *this;
+    }
+};
+
+/* Everything that makes one graphics pipeline different from another. Two pipelines with equal descriptions are the
+same pipeline, so GraphicsPipelineCache creates each description only once. The vertex input state and the pipeline
+layout are derived from the shaders (see ShaderReflection), so the shader hashes cover them too. Each set of
+specialization constants is a separate pipeline (a variant of the same shaders).*/
+struct GraphicsPipelineDescription {
+    // FNV-1a 64 of each shader's SPIR-V.
+    uint64_t vertexShaderHash = 0;
+    uint64_t fragmentShaderHash = 0;
+    SpecializationConstants vertexConstants;
+    SpecializationConstants fragmentConstants;
+    VkRenderPass renderPass = VK_NULL_HANDLE;
+    uint32_t subpass = 0;
+    VkPrimitiveTopology topology = VK_PRIMITIVE_TOPOLOGY_TRIANGLE_LIST;
+    VkPolygonMode polygonMode = VK_POLYGON_MODE_FILL;
+    VkCullModeFlags cullMode = VK_CULL_MODE_BACK_BIT;
+    VkFrontFace frontFace = VK_FRONT_FACE_CLOCKWISE;
+    VkBool32 blendEnable = VK_FALSE;
+    VkColorComponentFlags colorWriteMask = VK_COLOR_COMPONENT_R_BIT | VK_COLOR_COMPONENT_G_BIT | VK_COLOR_COMPONENT_B_BIT | VK_COLOR_COMPONENT_A_BIT;
+    // No extent: the viewport and scissor are dynamic state, so one pipeline works at any resolution.
+
+    bool operator==(const GraphicsPipelineDescription& other) const {
+        return vertexShaderHash == other.vertexShaderHash && fragmentShaderHash == other.fragmentShaderHash
+            && vertexConstants == other.vertexConstants && fragmentConstants == other.fragmentConstants
+            && renderPass == other.renderPass && subpass == other.subpass && topology == other.topology
+            && polygonMode == other.polygonMode && cullMode == other.cullMode && frontFace == other.frontFace
+            && blendEnable == other.blendEnable && colorWriteMask == other.colorWriteMask;
+    }
+
+    // Hashed field by field, as the padding between fields isn't guaranteed to be zeroed.
+    uint64_t hash() const {
+        uint64_t hash = fnv1a64(&vertexShaderHash, sizeof(vertexShaderHash));
+        hash = fnv1a64(&fragmentShaderHash, sizeof(fragmentShaderHash), hash);
+        hash = vertexConstants.hash(hash);
+        hash = fragmentConstants.hash(hash);
+        hash = fnv1a64(&renderPass, sizeof(renderPass), hash);
+        hash = fnv1a64(&subpass, sizeof(subpass), hash);
+        hash = fnv1a64(&topology, sizeof(topology), hash);
+        hash = fnv1a64(&polygonMode, sizeof(polygonMode), hash);
+        hash = fnv1a64(&cullMode, sizeof(cullMode), hash);
+        hash = fnv1a64(&frontFace, sizeof(frontFace), hash);
+        hash = fnv1a64(&blendEnable, sizeof(blendEnable), hash);
+        return fnv1a64(&colorWriteMask, sizeof(colorWriteMask), hash);
+    }
+};
+
+// A pipeline and the layout it was created with (which belongs to the PipelineLayoutCache).
+struct GraphicsPipeline {
+    VkPipeline pipeline = VK_NULL_HANDLE;
+    VkPipelineLayout layout = VK_NULL_HANDLE;
+};
+
+/* The VK_EXT_shader_object replacement for a GraphicsPipeline: a linked vertex and fragment shader, bound on their own.
+Nothing else is baked in, so the vertex input state the pipeline would have held is kept here to set in the command
+buffer. The layout belongs to the PipelineLayoutCache, and is only used to bind descriptors and push constants.*/
+struct ShaderObjects {
+    VkShaderEXT vertex = VK_NULL_HANDLE;
+    VkShaderEXT fragment = VK_NULL_HANDLE;
+    VkPipelineLayout layout = VK_NULL_HANDLE;
+    std::vector<VkVertexInputBindingDescription2EXT> vertexBindings;
+    std::vector<VkVertexInputAttributeDescription2EXT> vertexAttributes;
+};
+
+/* VK_EXT_shader_object functions, looked up once the device is created. With shader objects every piece of state a
+pipeline would have baked in is dynamic, so this includes the VK_EXT_extended_dynamic_state(2/3) and
+VK_EXT_vertex_input_dynamic_state commands, which VK_EXT_shader_object provides without those extensions.*/
+struct ShaderObjectFunctions {
+    PFN_vkCreateShadersEXT createShaders = nullptr;
+    PFN_vkDestroyShaderEXT destroyShader = nullptr;
+    PFN_vkCmdBindShadersEXT cmdBindShaders = nullptr;
+    PFN_vkCmdSetViewportWithCountEXT cmdSetViewportWithCount = nullptr;
+    PFN_vkCmdSetScissorWithCountEXT cmdSetScissorWithCount = nullptr;
+    PFN_vkCmdSetRasterizerDiscardEnableEXT cmdSetRasterizerDiscardEnable = nullptr;
+    PFN_vkCmdSetPolygonModeEXT cmdSetPolygonMode = nullptr;
+    PFN_vkCmdSetRasterizationSamplesEXT cmdSetRasterizationSamples = nullptr;
+    PFN_vkCmdSetSampleMaskEXT cmdSetSampleMask = nullptr;
+    PFN_vkCmdSetAlphaToCoverageEnableEXT cmdSetAlphaToCoverageEnable = nullptr;
+    PFN_vkCmdSetCullModeEXT cmdSetCullMode = nullptr;
+    PFN_vkCmdSetFrontFaceEXT cmdSetFrontFace = nullptr;
+    PFN_vkCmdSetDepthTestEnableEXT cmdSetDepthTestEnable = nullptr;
+    PFN_vkCmdSetDepthWriteEnableEXT cmdSetDepthWriteEnable = nullptr;
+    PFN_vkCmdSetDepthBiasEnableEXT cmdSetDepthBiasEnable = nullptr;
+    PFN_vkCmdSetStencilTestEnableEXT cmdSetStencilTestEnable = nullptr;
+    PFN_vkCmdSetPrimitiveTopologyEXT cmdSetPrimitiveTopology = nullptr;
+    PFN_vkCmdSetPrimitiveRestartEnableEXT cmdSetPrimitiveRestartEnable = nullptr;
+    PFN_vkCmdSetVertexInputEXT cmdSetVertexInput = nullptr;
+    PFN_vkCmdSetColorBlendEnableEXT cmdSetColorBlendEnable = nullptr;
+    PFN_vkCmdSetColorBlendEquationEXT cmdSetColorBlendEquation = nullptr;
+    PFN_vkCmdSetColorWriteMaskEXT cmdSetColorWriteMask = nullptr;
+};
+
+/* Owns graphics pipelines, keyed by their description, so asking for the same state twice (say, many materials that
+share shaders and blend state) returns the existing VkPipeline instead of compiling a duplicate. A lookup is one hash of
+the description and one hash table probe, cheap enough to do per draw.
+
+Thread safe. If several threads miss on the same description at once, only the first one creates the pipeline and the
+others wait for it, so every description is compiled once.*/
+class GraphicsPipelineCache {
+public:
+    /* Get the pipeline for description, calling create (on this thread) to make it if there isn't one yet. Rethrows what create throws.
+    create is a template parameter rather than a std::function, so the per-draw hit path doesn't pay for type erasure,
+    and the promise other threads wait on is only made on a miss.*/
+    template <typename Create>
+    GraphicsPipeline getOrCreate(const GraphicsPipelineDescription& description, Create&& create) {
+        std::unique_lock<std::mutex> lock(mutex);
+        auto existing = pipelines.find(description);
+        if (existing != pipelines.end()) {
+            hitCount++;
+            // Failed creates are erased before their exception is set, so a ready entry always has a pipeline and the common case is done under the lock.
+            if (existing->second.wait_for(std::chrono::seconds(0)) == std::future_status::ready) {
+                return existing->second.get();
+            }
+            std::shared_future<GraphicsPipeline> pipeline = existing->second;
+            // Still being created by another thread, so wait outside the lock.
+            lock.unlock();
+            return pipeline.get();
+        }
+        missCount++;
+        std::promise<GraphicsPipeline> promise;
+        pipelines.emplace(description, promise.get_future().share());
+        lock.unlock();
+
+        try {
+            GraphicsPipeline pipeline = create();
+            promise.set_value(pipeline);
+            return pipeline;
+        }
+        catch (...) {
+            // Forget the failed entry so the next call tries again, and pass the error on to anyone waiting.
+            lock.lock();
+            pipelines.erase(description);
+            lock.unlock();
+            promise.set_exception(std::current_exception());
+            throw;
+        }
+    }
+
+    /* Take a pipeline out of the cache, for example because its shaders were replaced, and return it so the caller can
+    destroy it once the GPU is done with it. Returns VK_NULL_HANDLE if description isn't cached (or is still being created).*/
+    VkPipeline remove(const GraphicsPipelineDescription& description) {
+        std::lock_guard<std::mutex> lock(mutex);
+        auto existing = pipelines.find(description);
+        if (existing == pipelines.end() || existing->second.wait_for(std::chrono::seconds(0)) != std::future_status::ready) {
+            return VK_NULL_HANDLE;
+        }
+        VkPipeline pipeline = VK_NULL_HANDLE;
+        try {
+            pipeline = existing->second.get().pipeline;
+        }
+        catch (const std::exception&) {
+        }
+        pipelines.erase(existing);
+        return pipeline;
+    }
+
+    /* Get the cached pipeline for description, if it's there and done being created. Only takes the lock and never
+    creates or waits, so it's the cheapest lookup for per-draw code that can fall back to getOrCreate on a miss.*/
+    bool find(const GraphicsPipelineDescription& description, GraphicsPipeline& pipeline) {
+        std::lock_guard<std::mutex> lock(mutex);
+        auto existing = pipelines.find(description);
+        if (existing == pipelines.end() || existing->second.wait_for(std::chrono::seconds(0)) != std::future_status::ready) {
+            return false;
+        }
+        // Failed creates are erased before their exception is set, so a ready entry always has a pipeline.
+        hitCount++;
+        pipeline = existing->second.get();
+        return true;
+    }
+
+    /* Swap the cached pipeline for description with a better one made from the same state (like a link time optimized
+    build of a fast-linked pipeline). Returns the old pipeline for the caller to destroy once the GPU is done with it, or
+    VK_NULL_HANDLE if description isn't cached anymore, in which case nothing changed.*/
+    VkPipeline replace(const GraphicsPipelineDescription& description, const GraphicsPipeline& pipeline) {
+        std::lock_guard<std::mutex> lock(mutex);
+        auto existing = pipelines.find(description);
+        if (existing == pipelines.end() || existing->second.wait_for(std::chrono::seconds(0)) != std::future_status::ready) {
+            return VK_NULL_HANDLE;
+        }
+        // Failed creates are erased before their exception is set, so a ready entry always has a pipeline.
+        VkPipeline oldPipeline = existing->second.get().pipeline;
+        std::promise<GraphicsPipeline> replacement;
+        replacement.set_value(pipeline);
+        existing->second = replacement.get_future().share();
+        return oldPipeline;
+    }
+
+    // Destroy every pipeline. Nothing may still be creating one.
+    void destroy(VkDevice device) {
+        std::lock_guard<std::mutex> lock(mutex);
+        for (auto& entry : pipelines) {
+            try {
+                vkDestroyPipeline(device, entry.second.get().pipeline, nullptr);
+            }
+            catch (const std::exception&) {
+            }
+        }
+        pipelines.clear();
+    }
+
+    // The vertex and fragment shader hashes of every cached pipeline, including ones still being created.
+    std::set<uint64_t> getShaderHashes() {
+        std::lock_guard<std::mutex> lock(mutex);
+        std::set<uint64_t> shaderHashes;
+        for (const auto& entry : pipelines) {
+            shaderHashes.insert(entry.first.vertexShaderHash);
+            shaderHashes.insert(entry.first.fragmentShaderHash);
+        }
+        return shaderHashes;
+    }
+
+    size_t getPipelineCount() {
+        std::lock_guard<std::mutex> lock(mutex);
+        return pipelines.size();
+    }
+
+    uint64_t getHitCount() {
+        std::lock_guard<std::mutex> lock(mutex);
+        return hitCount;
+    }
+
+    uint64_t getMissCount() {
+        std::lock_guard<std::mutex> lock(mutex);
+        return missCount;
+    }
+
+private:
+    struct DescriptionHash {
+        size_t operator()(const GraphicsPipelineDescription& description) const {
+            return static_cast<size_t>(description.hash());
+        }
+    };
+
+    std::mutex mutex;
+    std::unordered_map<GraphicsPipelineDescription, std::shared_future<GraphicsPipeline>, DescriptionHash> pipelines;
+    uint64_t hitCount = 0;
+    uint64_t missCount = 0;
+};
+
+/* Owns the parts of graphics pipelines created with VK_EXT_graphics_pipeline_library: vertex input interface,
+pre-rasterization shaders, fragment shader and fragment output interface. Each part only depends on a slice of the
+pipeline state, so when a new combination of state shows up, most of its parts are usually already here, and the few
+missing ones are much quicker to compile than a whole pipeline. Linking parts into a pipeline is fast.
+
+Parts are keyed by a hash of the state they're made from, and are created once, like GraphicsPipelineCache. Shader
+parts are dropped once no pipeline uses their shader anymore (see removeUnused()).*/
+class PipelineLibraryCache {
+public:
+    /* Get the part for key, calling create (on this thread) if there isn't one yet. Rethrows what create throws.
+    shaderHash is the hash of the part's shader, or 0 for the parts without one (see removeUnused()).*/
+    template <typename Create>
+    VkPipeline getOrCreate(uint64_t key, uint64_t shaderHash, Create&& create) {
+        std::unique_lock<std::mutex> lock(mutex);
+        auto existing = libraries.find(key);
+        if (existing != libraries.end()) {
+            std::shared_future<VkPipeline> library = existing->second.library;
+            lock.unlock();
+            return library.get();
+        }
+        std::promise<VkPipeline> promise;
+        libraries.emplace(key, Library{ shaderHash, promise.get_future().share() });
+        lock.unlock();
+
+        try {
+            VkPipeline library = create();
+            promise.set_value(library);
+            return library;
+        }
+        catch (...) {
+            lock.lock();
+            libraries.erase(key);
+            lock.unlock();
+            promise.set_exception(std::current_exception());
+            throw;
+        }
+    }
+
+    /* Take the shader parts whose shader isn't in shaderHashesInUse out of the cache, and return them so the caller can
+    destroy them once nothing links from them anymore. Without this, every edit of a hot reloaded shader would leave its
+    old parts behind until cleanup. The vertex input and fragment output parts have no shader and are kept, there's one
+    per combination of fixed function state, which doesn't grow with shader edits. Parts still being created are kept too.*/
+    std::vector<VkPipeline> removeUnused(const std::set<uint64_t>& shaderHashesInUse) {
+        std::lock_guard<std::mutex> lock(mutex);
+        std::vector<VkPipeline> removed;
+        for (auto entry = libraries.begin(); entry != libraries.end(); ) {
+            const Library& library = entry->second;
+            if (library.shaderHash == 0 || shaderHashesInUse.count(library.shaderHash) != 0 ||
+                library.library.wait_for(std::chrono::seconds(0)) != std::future_status::ready) {
+                ++entry;
+                continue;
+            }
+            // Failed creates are erased before their exception is set, so a ready entry always has a part.
+            removed.push_back(library.library.get());
+            entry = libraries.erase(entry);
+        }
+        return removed;
+    }
+
+    // Destroy every part. Pipelines linked from them don't need them anymore. Nothing may still be creating one.
+    void destroy(VkDevice device) {
+        std::lock_guard<std::mutex> lock(mutex);
+        for (auto& entry : libraries) {
+            try {
+                vkDestroyPipeline(device, entry.second.library.get(), nullptr);
+            }
+            catch (const std::exception&) {
+            }
+        }
+        libraries.clear();
+    }
+
+    size_t getLibraryCount() {
+        std::lock_guard<std::mutex> lock(mutex);
+        return libraries.size();
+    }
+
+private:
+    struct Library {
+        uint64_t shaderHash;
+        std::shared_future<VkPipeline> library;
+    };
+
+    std::mutex mutex;
+    std::unordered_map<uint64_t, Library> libraries;
+};
+
+/* What VK_EXT_pipeline_creation_feedback said about each pipeline that was created: how long the driver took, per
+pipeline and per shader stage, and whether it came out of the VkPipelineCache. Without the extension (or when the
+driver doesn't fill it in) only the time measured around the call is known. Thread safe, as pipelines are created on
+the compiler threads.*/
+class PipelineCreationStats {
+public:
+    struct Stage {
+        VkShaderStageFlagBits stage;
+        // fnv1a64 of the stage's SPIR-V, so an expensive shader can be found again.
+        uint64_t shaderHash;
+        double ms;
+        bool cacheHit;
+    };
+    struct Record {
+        // What was created: "pipeline", "library" (a VK_EXT_graphics_pipeline_library part), "link" or "optimized_link".
+        std::string kind;
+        // Whether ms and cacheHit came from the driver. If not, ms is the time measured around vkCreateGraphicsPipelines.
+        bool feedback;
+        double ms;
+        bool cacheHit;
+        std::vector<Stage> stages;
+    };
+
+    void record(Record record) {
+        std::lock_guard<std::mutex> lock(mutex);
+        records.push_back(std::move(record));
+    }
+
+    std::vector<Record> getRecords() {
+        std::lock_guard<std::mutex> lock(mutex);
+        return records;
+    }
+
+    // How many pipelines the driver found in the pipeline cache.
+    size_t getCacheHitCount() {
+        std::lock_guard<std::mutex> lock(mutex);
+        return static_cast<size_t>(std::count_if(records.begin(), records.end(), [](const Record& r) { return r.cacheHit; }));
+    }
+
+private:
+    std::mutex mutex;
+    std::vector<Record> records;
+};
+
+/* Watches a directory for files being written, created or moved into it, using inotify. Only available on Linux,
+elsewhere isWatching() is always false.*/
+class DirectoryWatcher {
+public:
+    DirectoryWatcher() = default;
+    ~DirectoryWatcher() {
+#ifdef __linux__
+        if (fd >= 0) {
+            close(fd);
+        }
+#endif
+    }
+
+    DirectoryWatcher(const DirectoryWatcher&) = delete;
+    DirectoryWatcher& operator=(const DirectoryWatcher&) = delete;
+
+    // Start watching directory. Returns false if it can't be watched.
+    bool watch(const std::string& directory) {
+#ifdef __linux__
+        // Non-blocking, so poll() can be called every frame.
+        fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+        if (fd < 0) {
+            return false;
+        }
+        /* Editors either write files in place (IN_CLOSE_WRITE) or write a temporary file and rename it over the original (IN_MOVED_TO).
+        IN_CREATE isn't watched, it fires before anything is written and would reload an empty file.*/
+        if (inotify_add_watch(fd, directory.c_str(), IN_CLOSE_WRITE | IN_MOVED_TO) < 0) {
+            close(fd);
+            fd = -1;
+            return false;
+        }
+        return true;
+#else
+        return false;
+#endif
+    }
+
+    bool isWatching() const {
+        return fd >= 0;
+    }
+
+    // Add the names of files that changed since the last call to changedFiles, without blocking. Returns true if anything changed.
+    bool poll(std::vector<std::string>& changedFiles) {
+        bool changed = false;
+#ifdef __linux__
+        if (fd < 0) {
+            return false;
+        }
+        // Events are variable length (the name follows the struct), so read into a buffer aligned for inotify_event.
+        alignas(inotify_event) char buffer[4096];
+        while (true) {
+            ssize_t length = read(fd, buffer, sizeof(buffer));
+            if (length <= 0) {
+                break;
+            }
+            for (char* event = buffer; event < buffer + length; ) {
+                const inotify_event* info = reinterpret_cast<const inotify_event*>(event);
+                if (info->len > 0) {
+                    changedFiles.push_back(info->name);
+                    changed = true;
+                }
+                event += sizeof(inotify_event) + info->len;
+            }
+        }
+#endif
+        return changed;
+    }
+
+private:
+    int fd = -1;
+};
+
+// Summary of a list of timings (in milliseconds).
+struct TimingSummary {
+    double mean = 0.0;
+    double p50 = 0.0;
+    double p95 = 0.0;
+    double p99 = 0.0;
+    double max = 0.0;
+    double total = 0.0;
+
+    // Percentiles use the nearest-rank method, so they are always one of the actual samples.
+    static TimingSummary fromSamples(std::vector<double> samples) {
+        TimingSummary summary;
+        if (samples.empty()) {
+            return summary;
+        }
+        std::sort(samples.begin(), samples.end());
+        auto percentile = [&samples](double p) {
+            size_t rank = static_cast<size_t>(std::ceil(p / 100.0 * samples.size()));
+            return samples[std::max<size_t>(rank, 1) - 1];
+        };
+        for (double sample : samples) {
+            summary.total += sample;
+        }
+        summary.mean = summary.total / samples.size();
+        summary.p50 = percentile(50.0);
+        summary.p95 = percentile(95.0);
+        summary.p99 = percentile(99.0);
+        summary.max = samples.back();
+        return summary;
+    }
+
+    // Write the summary out as a JSON object.
+    void writeJson(std::ostream& out) const {
+        out << "{ \"mean\": " << mean << ", \"p50\": " << p50 << ", \"p95\": " << p95
+            << ", \"p99\": " << p99 << ", \"max\": " << max << ", \"total\": " << total << " }";
+    }
+};
+
+/* Picks the number of frames in flight at runtime. Frames are measured in windows, and after each window the tuner
+looks at the average frame time and how long the CPU was blocked waiting on the GPU (fences):
+    - If one more was measured to be faster, go back to it. This is how a depth that starved the GPU gets undone.
+    - Otherwise try one less, unless one less was already measured to be slower. In particular, if the CPU was blocked
+      the GPU is the bottleneck and the CPU is already far enough ahead of it, so more frames queued only add latency.
+    - If the CPU wasn't blocked but frames got slower than last time at this depth, the GPU may be going idle between
+      frames, so try one more (unless one more was already measured to be no faster).
+This settles on the smallest depth that keeps the GPU busy. Measurements expire after a while so the tuner re-checks
+its choice if the workload changes.*/
+class FramesInFlightTuner {
+public:
+    FramesInFlightTuner(uint32_t initialDepth, uint32_t maxDepth) : depth(initialDepth), maxDepth(maxDepth), measurements(maxDepth + 1) {}
+
+    // Record one frame. Returns the frames in flight to use from now on.
+    uint32_t recordFrame(double frameTimeMs, double fenceWaitMs) {
+        // The first few frames after a change still overlap with frames queued at the old depth, so don't count them.
+        if (settleFrames > 0) {
+            settleFrames--;
+            return depth;
+        }
+
+        windowFrameTimeMs += frameTimeMs;
+        windowFenceWaitMs += fenceWaitMs;
+        if (++windowFrames < WINDOW_FRAMES) {
+            return depth;
+        }
+
+        double meanFrameTime = windowFrameTimeMs / windowFrames;
+        double meanFenceWait = windowFenceWaitMs / windowFrames;
+        windowFrames = 0;
+        windowFrameTimeMs = 0.0;
+        windowFenceWaitMs = 0.0;
+
+        // Forget old measurements, so a change in workload gets noticed.
+        for (auto& measurement : measurements) {
+            if (measurement.measured && ++measurement.age > MAX_MEASUREMENT_AGE) {
+                measurement = {};
+            }
+        }
+        const Measurement previous = measurements[depth];
+        measurements[depth] = { true, meanFrameTime, 0 };
+
+        const Measurement& shallower = measurements[depth - 1];
+        const Measurement& deeper = measurements[std::min(depth + 1, maxDepth)];
+        bool cpuWaiting = meanFenceWait > LOW_WAIT_RATIO * meanFrameTime;
+        bool deeperIsFaster = depth < maxDepth && deeper.measured && deeper.frameTimeMs < meanFrameTime * (1.0 - TOLERANCE);
+        bool deeperIsNoFaster = depth < maxDepth && deeper.measured && !deeperIsFaster;
+
+        if (deeperIsFaster) {
+            setDepth(depth + 1);
+        }
+        else if (depth > 1 && (!shallower.measured || shallower.frameTimeMs <= meanFrameTime * (1.0 + TOLERANCE))) {
+            setDepth(depth - 1);
+        }
+        else if (!cpuWaiting && depth < maxDepth && !deeperIsNoFaster && previous.measured && meanFrameTime > previous.frameTimeMs * (1.0 + TOLERANCE)) {
+            setDepth(depth + 1);
+        }
+        return depth;
+    }
+
+    uint32_t getDepth() const {
+        return depth;
+    }
+
+    // How many times the depth was changed.
+    uint32_t getChangeCount() const {
+        return changeCount;
+    }
+
+private:
+    // Frames averaged together for one measurement.
+    static const uint32_t WINDOW_FRAMES = 60;
+    // Number of windows a measurement is trusted for.
+    static const uint32_t MAX_MEASUREMENT_AGE = 50;
+    // Below this fraction of the frame time, the CPU counts as not waiting on the GPU at all.
+    static constexpr double LOW_WAIT_RATIO = 0.05;
+    // Frame times within this fraction of each other count as the same.
+    static constexpr double TOLERANCE = 0.05;
+
+    struct Measurement {
+        bool measured = false;
+        double frameTimeMs = 0.0;
+        uint32_t age = 0;
+    };
+
+    void setDepth(uint32_t newDepth) {
+        depth = newDepth;
+        settleFrames = newDepth + 1;
+        changeCount++;
+    }
+
+    uint32_t depth;
+    uint32_t maxDepth;
+    // Indexed by depth. Index 0 is unused.
+    std::vector<Measurement> measurements;
+
+    uint32_t settleFrames = 0;
+    uint32_t windowFrames = 0;
+    double windowFrameTimeMs = 0.0;
+    double windowFenceWaitMs = 0.0;
+    uint32_t changeCount = 0;
+};
+
+/* A fixed set of worker threads that run jobs from a shared queue. Each job is given the index of the thread running
+it, so jobs can use per-thread resources (ie command pools, which must only be used by one thread at a time) without
+any locking. Jobs given to submit() must not throw, parallelFor() passes exceptions back to the caller.*/
+class WorkerThreadPool {
+public:
+    // name labels the threads in the profiler.
+    explicit WorkerThreadPool(uint32_t threadCount, const std::string& name = "Worker") {
+        for (uint32_t i = 0; i < threadCount; i++) {
+            threads.emplace_back([this, i, name]() {
+                std::string threadName = name + " " + std::to_string(i);
+                Profiler::setThreadName(threadName.c_str());
+                workerLoop(i);
+            });
+        }
+    }
+
+    // Finish the queued jobs, then stop and join the threads.
+    ~WorkerThreadPool() {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            stopping = true;
+        }
+        jobAvailable.notify_all();
+        for (auto& thread : threads) {
+            thread.join();
+        }
+    }
+
+    WorkerThreadPool(const WorkerThreadPool&) = delete;
+    WorkerThreadPool& operator=(const WorkerThreadPool&) = delete;
+
+    uint32_t getThreadCount() const {
+        return static_cast<uint32_t>(threads.size());
+    }
+
+    // Queue a job to run on any worker thread.
+    void submit(std::function<void(uint32_t threadIndex)> job) {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            jobs.push_back(std::move(job));
+        }
+        jobAvailable.notify_one();
+    }
+
+    // Run fn(threadIndex, i) for every i in [0, count) across the workers, and block until they're all done. If any of them throws, the first exception is rethrown here.
+    void parallelFor(uint32_t count, const std::function<void(uint32_t threadIndex, uint32_t index)>& fn) {
+        std::mutex doneMutex;
+        std::condition_variable done;
+        uint32_t remaining = count;
+        std::exception_ptr error;
+
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            for (uint32_t i = 0; i < count; i++) {
+                jobs.push_back([&, i](uint32_t threadIndex) {
+                    std::exception_ptr jobError;
+                    try {
+                        fn(threadIndex, i);
+                    }
+                    catch (...) {
+                        jobError = std::current_exception();
+                    }
+                    // Notify while still holding the lock, so the caller can't return (and destroy doneMutex) before we're done with it.
+                    std::lock_guard<std::mutex> doneLock(doneMutex);
+                    if (jobError && !error) {
+                        error = jobError;
+                    }
+                    if (--remaining == 0) {
+                        done.notify_one();
+                    }
+                });
+            }
+        }
+        jobAvailable.notify_all();
+
+        std::unique_lock<std::mutex> lock(doneMutex);
+        done.wait(lock, [&]() { return remaining == 0; });
+        if (error) {
+            std::rethrow_exception(error);
+        }
+    }
+
+private:
+    void workerLoop(uint32_t threadIndex) {
+        while (true) {
+            std::function<void(uint32_t)> job;
+            {
+                std::unique_lock<std::mutex> lock(mutex);
+                jobAvailable.wait(lock, [this]() { return stopping || !jobs.empty(); });
+                if (jobs.empty()) {
+                    return;
+                }
+                job = std::move(jobs.front());
+                jobs.pop_front();
+            }
+            job(threadIndex);
+        }
+    }
+
+    std::vector<std::thread> threads;
+    std::mutex mutex;
+    std::condition_variable jobAvailable;
+    std::deque<std::function<void(uint32_t)>> jobs;
+    bool stopping = false;
+};
+
+/* Compiles graphics pipelines on a pool of worker threads, so a batch of pipelines (all of a scene's materials at
+startup, say) takes about as long as its slowest pipelines on a machine with enough cores, instead of all of them in a
+row. Every worker goes through the same GraphicsPipelineCache, so nothing is compiled twice even across batches, and
+the same VkPipelineCache, which is safe to share because it isn't created with
+VK_PIPELINE_CACHE_CREATE_EXTERNALLY_SYNCHRONIZED_BIT (the driver locks it internally).*/
+class PipelineCompiler {
+public:
+    struct Request {
+        GraphicsPipelineDescription description;
+        // Creates the pipeline if the cache doesn't have it yet. Runs on a worker thread, so whatever it uses has to stay alive until its future is ready.
+        std::function<GraphicsPipeline()> create;
+    };
+
+    PipelineCompiler(GraphicsPipelineCache& cache, uint32_t threadCount)
+        : cache(cache), threads(threadCount, "Pipeline compiler") {
+    }
+
+    uint32_t getThreadCount() const {
+        return threads.getThreadCount();
+    }
+
+    // Queue the requests and return right away, with a future per request (in request order). Each future gets the pipeline, or what create threw, as soon as that pipeline is done.
+    std::vector<std::shared_future<GraphicsPipeline>> compile(std::vector<Request> requests) {
+        std::vector<std::shared_future<GraphicsPipeline>> pipelines;
+        for (auto& request : requests) {
+            auto promise = std::make_shared<std::promise<GraphicsPipeline>>();
+            pipelines.push_back(promise->get_future().share());
+            threads.submit([this, promise, request = std::move(request)](uint32_t) {
+                PROFILE_ZONE("compilePipeline");
+                try {
+                    promise->set_value(cache.getOrCreate(request.description, request.create));
+                }
+                catch (...) {
+                    promise->set_exception(std::current_exception());
+                }
+            });
+        }
+        return pipelines;
+    }
+
+    // Run create on a compiler thread without going through the cache, ie to build a replacement for a cached pipeline.
+    std::shared_future<GraphicsPipeline> compileUncached(std::function<GraphicsPipeline()> create) {
+        auto promise = std::make_shared<std::promise<GraphicsPipeline>>();
+        std::shared_future<GraphicsPipeline> pipeline = promise->get_future().share();
+        threads.submit([promise, create = std::move(create)](uint32_t) {
+            PROFILE_ZONE("compilePipelineUncached");
+            try {
+                promise->set_value(create());
+            }
+            catch (...) {
+                promise->set_exception(std::current_exception());
+            }
+        });
+        return pipeline;
+    }
+
+    // Block until all the pipelines are done, and return them in order. If any failed, the first failure is rethrown (after the rest are done, so nothing is still using the caller's data).
+    static std::vector<GraphicsPipeline> wait(const std::vector<std::shared_future<GraphicsPipeline>>& pipelines) {
+        for (const auto& pipeline : pipelines) {
+            pipeline.wait();
+        }
+        std::vector<GraphicsPipeline> results;
+        for (const auto& pipeline : pipelines) {
+            results.push_back(pipeline.get());
+        }
+        return results;
+    }
+
+private:
+    GraphicsPipelineCache& cache;
+    WorkerThreadPool threads;
+};
+
+// Per-frame timings collected during the measured part of a benchmark run.
+struct FrameStatistics {
+    // Time spent on the CPU for each frame, from the top of one main loop iteration to the next.
+    std::vector<double> cpuFrameTimesMs;
+    // Time each frame spent blocked in vkWaitForFences, waiting on the GPU.
+    std::vector<double> fenceWaitTimesMs;
+    // Time the GPU spent executing each frame's command buffer, measured with timestamp queries. These come in a couple frames late (once the GPU is done with the frame), so aren't recorded in lockstep with the CPU timings.
+    std::vector<double> gpuFrameTimesMs;
+
+    void reserve(size_t frameCount) {
+        cpuFrameTimesMs.reserve(frameCount);
+        fenceWaitTimesMs.reserve(frameCount);
+        gpuFrameTimesMs.reserve(frameCount);
+    }
 
+    void recordFrame(double cpuFrameTimeMs, double fenceWaitTimeMs) {
+        cpuFrameTimesMs.push_back(cpuFrameTimeMs);
+        fenceWaitTimesMs.push_back(fenceWaitTimeMs);
+    }
+};
 
-const uint32_t WIDTH = 800;
-const uint32_t HEIGHT = 600;
-// How many frames can be processed in parallel by the GPU at once.
-const int MAX_FRAMES_IN_FLIGHT = 2;
+/* Sub-allocates buffers and images out of a few large VkDeviceMemory blocks per memory type, instead of calling
+vkAllocateMemory for every resource. Allocating device memory is slow, and drivers only allow
+maxMemoryAllocationCount allocations at once (as low as 4096), which a real scene would run out of.
 
-// Add two configuration variables to specify the layers to enable...
-const std::vector<const char*> validationLayers = {
-    "VK_LAYER_KHRONOS_validation"
-};
-// ... and whether to enable them.
-#ifdef NDEBUG
-const bool enableValidationLayers = false;
-#else
-const bool enableValidationLayers = true;
-#endif
+Each block is split with a buddy allocator. An allocation is rounded up to a power of two (at least MIN_ALLOCATION)
+and carved out by halving a free range until it fits. When it's freed, it's merged back with its buddy (the other half
+it was split from) for as long as the buddy is free too. A range is always aligned to its own size, so any alignment
+up to the allocation's size is met for free. Resources bigger than half a block get their own VkDeviceMemory
+(a dedicated allocation), since rounding them up would waste too much.
 
-// Define the required physical device extensions.
-const std::vector<const char*> deviceExtensions = {
-    VK_KHR_SWAPCHAIN_EXTENSION_NAME
+bufferImageGranularity: on some GPUs, a linear resource (a buffer, or a linearly tiled image) and an optimally tiled
+image can't share a page of that size. Buddy ranges are aligned to their size, so with a granularity up to
+MIN_ALLOCATION two ranges never share a page. With a bigger granularity, linear and optimal resources go to separate
+pools (of the same memory type) and never share a block.
+
+Host visible blocks are mapped once for their whole lifetime (a VkDeviceMemory can only be mapped once), and allocations
+from them get a pointer into that mapping. Thread safe.*/
+class DeviceMemoryAllocator {
+public:
+    static constexpr VkDeviceSize DEFAULT_BLOCK_SIZE = 64ull * 1024 * 1024;
+    static constexpr VkDeviceSize MIN_ALLOCATION = 256;
+
+    // Where a resource's memory is. Bind the resource to memory at offset, and hand it back to free() when the resource is destroyed.
+    struct Allocation {
+        VkDeviceMemory memory = VK_NULL_HANDLE;
+        VkDeviceSize offset = 0;
+        // The size that was asked for. The range reserved for it may be bigger.
+        VkDeviceSize size = 0;
+        // Points at offset in host visible memory, nullptr otherwise.
+        void* mapped = nullptr;
+        // The pool it came from and the size of its range (MIN_ALLOCATION << order). Dedicated allocations have neither.
+        uint32_t pool = 0;
+        uint32_t order = 0;
+        bool dedicated = false;
+    };
+
+    struct Statistics {
+        // VkDeviceMemory objects: blocks plus dedicated allocations.
+        uint64_t deviceMemoryCount = 0;
+        uint64_t blockCount = 0;
+        VkDeviceSize blockBytes = 0;
+        uint64_t dedicatedCount = 0;
+        VkDeviceSize dedicatedBytes = 0;
+        // Resources living in blocks, the bytes they asked for, and the bytes reserved for them after rounding up.
+        uint64_t allocationCount = 0;
+        VkDeviceSize usedBytes = 0;
+        VkDeviceSize reservedBytes = 0;
+        // Free space in the blocks, and the biggest single free range.
+        VkDeviceSize freeBytes = 0;
+        VkDeviceSize largestFreeRange = 0;
+        // 0 when the free space is in one piece, approaching 1 the more it's split into small pieces.
+        double fragmentation = 0.0;
+    };
+
+    void init(VkPhysicalDevice physicalDevice, VkDevice device, VkDeviceSize preferredBlockSize = DEFAULT_BLOCK_SIZE) {
+        this->device = device;
+        vkGetPhysicalDeviceMemoryProperties(physicalDevice, &memoryProperties);
+        VkPhysicalDeviceProperties properties;
+        vkGetPhysicalDeviceProperties(physicalDevice, &properties);
+        bufferImageGranularity = properties.limits.bufferImageGranularity;
+        maxDeviceMemoryCount = properties.limits.maxMemoryAllocationCount;
+        this->preferredBlockSize = roundDownToPowerOfTwo(std::max(preferredBlockSize, MIN_ALLOCATION));
+    }
+
+    // Allocate memory for a resource with the given requirements, from a memory type that has properties. linear is false for optimally tiled images.
+    Allocation allocate(const VkMemoryRequirements& requirements, VkMemoryPropertyFlags properties, bool linear) {
+        std::lock_guard<std::mutex> lock(mutex);
+        uint32_t memoryTypeIndex = findMemoryType(requirements.memoryTypeBits, properties);
+        VkDeviceSize blockSize = getBlockSize(memoryTypeIndex);
+        VkDeviceSize rangeSize = roundUpToPowerOfTwo(std::max({ requirements.size, requirements.alignment, MIN_ALLOCATION }));
+        if (rangeSize > blockSize / 2) {
+            return allocateDedicated(requirements, memoryTypeIndex);
+        }
+
+        Allocation allocation;
+        allocation.size = requirements.size;
+        allocation.pool = getPool(memoryTypeIndex, linear || bufferImageGranularity <= MIN_ALLOCATION, blockSize);
+        allocation.order = getOrder(rangeSize);
+        Pool& pool = pools[allocation.pool];
+        Block* block = nullptr;
+        for (auto& candidate : pool.blocks) {
+            if (allocateRange(*candidate, allocation.order, allocation.offset)) {
+                block = candidate.get();
+                break;
+            }
+        }
+        // Every block is too full, so start a new one.
+        if (block == nullptr) {
+            auto newBlock = std::make_unique<Block>();
+            newBlock->memory = allocateDeviceMemory(pool.blockSize, memoryTypeIndex, &newBlock->mapped);
+            newBlock->freeRanges.resize(getOrder(pool.blockSize) + 1);
+            newBlock->freeRanges.back().insert(0);
+            pool.blocks.push_back(std::move(newBlock));
+            block = pool.blocks.back().get();
+            allocateRange(*block, allocation.order, allocation.offset);
+        }
+        allocation.memory = block->memory;
+        allocation.mapped = block->mapped != nullptr ? static_cast<char*>(block->mapped) + allocation.offset : nullptr;
+        block->allocationCount++;
+        block->usedBytes += allocation.size;
+        return allocation;
+    }
+
+    void free(const Allocation& allocation) {
+        if (allocation.memory == VK_NULL_HANDLE) {
+            return;
+        }
+        std::lock_guard<std::mutex> lock(mutex);
+        if (allocation.dedicated) {
+            freeDeviceMemory(allocation.memory, allocation.mapped != nullptr);
+            dedicatedCount--;
+            dedicatedBytes -= allocation.size;
+            return;
+        }
+
+        Pool& pool = pools[allocation.pool];
+        auto block = std::find_if(pool.blocks.begin(), pool.blocks.end(), [&](const std::unique_ptr<Block>& b) { return b->memory == allocation.memory; });
+        if (block == pool.blocks.end()) {
+            throw std::runtime_error("ERROR! Freeing device memory that wasn't allocated by this allocator!");
+        }
+        freeRange(**block, allocation.order, allocation.offset);
+        (*block)->allocationCount--;
+        (*block)->usedBytes -= allocation.size;
+
+        // Give empty blocks back to the driver, but keep the last one of each pool around for the next allocation.
+        if ((*block)->allocationCount == 0 && pool.blocks.size() > 1) {
+            freeDeviceMemory((*block)->memory, (*block)->mapped != nullptr);
+            pool.blocks.erase(block);
+        }
+    }
+
+    // Free all of the blocks. Every resource should have been destroyed (and its allocation freed) by now.
+    void destroy() {
+        std::lock_guard<std::mutex> lock(mutex);
+        uint64_t leaked = dedicatedCount;
+        for (auto& pool : pools) {
+            for (auto& block : pool.blocks) {
+                leaked += block->allocationCount;
+                freeDeviceMemory(block->memory, block->mapped != nullptr);
+            }
+        }
+        pools.clear();
+        if (leaked > 0) {
+            std::cout << "WARNING! " << leaked << " device memory allocations were never freed.\n";
+        }
+    }
+
+    Statistics getStatistics() {
+        std::lock_guard<std::mutex> lock(mutex);
+        Statistics statistics;
+        statistics.deviceMemoryCount = deviceMemoryCount;
+        statistics.dedicatedCount = dedicatedCount;
+        statistics.dedicatedBytes = dedicatedBytes;
+        for (const auto& pool : pools) {
+            for (const auto& block : pool.blocks) {
+                statistics.blockCount++;
+                statistics.blockBytes += pool.blockSize;
+                statistics.allocationCount += block->allocationCount;
+                statistics.usedBytes += block->usedBytes;
+                for (size_t order = 0; order < block->freeRanges.size(); order++) {
+                    VkDeviceSize rangeSize = MIN_ALLOCATION << order;
+                    statistics.freeBytes += rangeSize * block->freeRanges[order].size();
+                    if (!block->freeRanges[order].empty()) {
+                        statistics.largestFreeRange = std::max(statistics.largestFreeRange, rangeSize);
+                    }
+                }
+            }
+        }
+        statistics.reservedBytes = statistics.blockBytes - statistics.freeBytes;
+        statistics.fragmentation = statistics.freeBytes > 0 ? 1.0 - static_cast<double>(statistics.largestFreeRange) / statistics.freeBytes : 0.0;
+        return statistics;
+    }
+
+private:
+    // One VkDeviceMemory, and its free ranges. freeRanges[order] holds the offsets of the free ranges of size MIN_ALLOCATION << order.
+    struct Block {
+        VkDeviceMemory memory = VK_NULL_HANDLE;
+        void* mapped = nullptr;
+        std::vector<std::set<VkDeviceSize>> freeRanges;
+        uint64_t allocationCount = 0;
+        VkDeviceSize usedBytes = 0;
+    };
+    // The blocks of one memory type, for either linear or optimal resources (or both, see bufferImageGranularity above).
+    struct Pool {
+        uint32_t memoryTypeIndex;
+        bool linear;
+        VkDeviceSize blockSize;
+        std::vector<std::unique_ptr<Block>> blocks;
+    };
+
+    std::mutex mutex;
+    VkDevice device = VK_NULL_HANDLE;
+    VkPhysicalDeviceMemoryProperties memoryProperties{};
+    VkDeviceSize bufferImageGranularity = 1;
+    uint32_t maxDeviceMemoryCount = 0;
+    VkDeviceSize preferredBlockSize = DEFAULT_BLOCK_SIZE;
+    std::vector<Pool> pools;
+    uint64_t deviceMemoryCount = 0;
+    uint64_t dedicatedCount = 0;
+    VkDeviceSize dedicatedBytes = 0;
+
+    static VkDeviceSize roundUpToPowerOfTwo(VkDeviceSize value) {
+        VkDeviceSize power = 1;
+        while (power < value) {
+            power <<= 1;
+        }
+        return power;
+    }
+
+    static VkDeviceSize roundDownToPowerOfTwo(VkDeviceSize value) {
+        VkDeviceSize power = 1;
+        while (power <= value / 2) {
+            power <<= 1;
+        }
+        return power;
+    }
+
+    // The order of a power of two range size, ie 0 for MIN_ALLOCATION.
+    static uint32_t getOrder(VkDeviceSize rangeSize) {
+        uint32_t order = 0;
+        while ((MIN_ALLOCATION << order) < rangeSize) {
+            order++;
+        }
+        return order;
+    }
+
+    // GPUs offer different types of memory, which differ in allowed operations and performance. Find the index of a memory type that is allowed by typeFilter (a bitmask from VkMemoryRequirements) and has all of the requested properties.
+    uint32_t findMemoryType(uint32_t typeFilter, VkMemoryPropertyFlags properties) const {
+        for (uint32_t i = 0; i < memoryProperties.memoryTypeCount; i++) {
+            if ((typeFilter & (1 << i)) && (memoryProperties.memoryTypes[i].propertyFlags & properties) == properties) {
+                return i;
+            }
+        }
+        throw std::runtime_error("ERROR! Failed to find a suitable memory type!");
+    }
+
+    // Small heaps (ie integrated GPUs' device local heap, or the 256 MB BAR heap) get smaller blocks, so one block doesn't take a big share of the heap.
+    VkDeviceSize getBlockSize(uint32_t memoryTypeIndex) const {
+        VkDeviceSize heapSize = memoryProperties.memoryHeaps[memoryProperties.memoryTypes[memoryTypeIndex].heapIndex].size;
+        if (heapSize <= 1024ull * 1024 * 1024) {
+            return std::max(MIN_ALLOCATION, std::min(preferredBlockSize, roundDownToPowerOfTwo(heapSize / 8)));
+        }
+        return preferredBlockSize;
+    }
+
+    uint32_t getPool(uint32_t memoryTypeIndex, bool linear, VkDeviceSize blockSize) {
+        for (uint32_t i = 0; i < pools.size(); i++) {
+            if (pools[i].memoryTypeIndex == memoryTypeIndex && pools[i].linear == linear) {
+                return i;
+            }
+        }
+        pools.push_back({ memoryTypeIndex, linear, blockSize, {} });
+        return static_cast<uint32_t>(pools.size() - 1);
+    }
+
+    // Take a free range of the given order from block, splitting a bigger one if there's none that size. Returns false if the block has no room.
+    static bool allocateRange(Block& block, uint32_t order, VkDeviceSize& offset) {
+        uint32_t freeOrder = order;
+        while (freeOrder < block.freeRanges.size() && block.freeRanges[freeOrder].empty()) {
+            freeOrder++;
+        }
+        if (freeOrder == block.freeRanges.size()) {
+            return false;
+        }
+        offset = *block.freeRanges[freeOrder].begin();
+        block.freeRanges[freeOrder].erase(block.freeRanges[freeOrder].begin());
+        // Keep the first half of each split, and put the second half (its buddy) on the free list.
+        while (freeOrder > order) {
+            freeOrder--;
+            block.freeRanges[freeOrder].insert(offset + (MIN_ALLOCATION << freeOrder));
+        }
+        return true;
+    }
+
+    // Put a range back, merging it with its buddy for as long as the buddy is free too.
+    static void freeRange(Block& block, uint32_t order, VkDeviceSize offset) {
+        while (order + 1 < block.freeRanges.size()) {
+            VkDeviceSize buddy = offset ^ (MIN_ALLOCATION << order);
+            auto freeBuddy = block.freeRanges[order].find(buddy);
+            if (freeBuddy == block.freeRanges[order].end()) {
+                break;
+            }
+            block.freeRanges[order].erase(freeBuddy);
+            offset = std::min(offset, buddy);
+            order++;
+        }
+        block.freeRanges[order].insert(offset);
+    }
+
+    Allocation allocateDedicated(const VkMemoryRequirements& requirements, uint32_t memoryTypeIndex) {
+        Allocation allocation;
+        allocation.size = requirements.size;
+        allocation.dedicated = true;
+        allocation.memory = allocateDeviceMemory(requirements.size, memoryTypeIndex, &allocation.mapped);
+        dedicatedCount++;
+        dedicatedBytes += requirements.size;
+        return allocation;
+    }
+
+    // The only place vkAllocateMemory is called. Host visible memory is mapped right away.
+    VkDeviceMemory allocateDeviceMemory(VkDeviceSize size, uint32_t memoryTypeIndex, void** mapped) {
+        if (deviceMemoryCount >= maxDeviceMemoryCount) {
+            throw std::runtime_error("ERROR! Out of device memory allocations (maxMemoryAllocationCount is " + std::to_string(maxDeviceMemoryCount) + ")!");
+        }
+        VkMemoryAllocateInfo allocInfo{};
+        allocInfo.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
+        allocInfo.allocationSize = size;
+        allocInfo.memoryTypeIndex = memoryTypeIndex;
+        VkDeviceMemory memory;
+        if (vkAllocateMemory(device, &allocInfo, nullptr, &memory) != VK_SUCCESS) {
+            throw std::runtime_error("ERROR! Failed to allocate " + std::to_string(size) + " bytes of device memory!");
+        }
+        *mapped = nullptr;
+        if (memoryProperties.memoryTypes[memoryTypeIndex].propertyFlags & VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT) {
+            if (vkMapMemory(device, memory, 0, VK_WHOLE_SIZE, 0, mapped) != VK_SUCCESS) {
+                vkFreeMemory(device, memory, nullptr);
+                throw std::runtime_error("ERROR! Failed to map device memory!");
+            }
+        }
+        deviceMemoryCount++;
+        return memory;
+    }
+
+    void freeDeviceMemory(VkDeviceMemory memory, bool mapped) {
+        if (mapped) {
+            vkUnmapMemory(device, memory);
+        }
+        vkFreeMemory(device, memory, nullptr);
+        deviceMemoryCount--;
+    }
 };
 
 
@@ -68,24 +2542,51 @@ struct SwapChainSupportDetails {
 // The program itself is wrapped into a class where we'll store the Vulkan objects as private class members and add funcs to initiate each of them, which will be called from the initVulkan func.
 class HelloTriangleApplication {
 public:
+    // reportOut is where the benchmark report goes when there's no --benchmark-output file.
+    HelloTriangleApplication(const AppSettings& settings, std::ostream& reportOut) : settings(settings), reportOut(reportOut),
+        frameSlotCount(settings.adaptiveFramesInFlight ? MAX_ADAPTIVE_FRAMES_IN_FLIGHT : settings.framesInFlight),
+        framesInFlight(settings.framesInFlight),
+        framesInFlightTuner(settings.framesInFlight, MAX_ADAPTIVE_FRAMES_IN_FLIGHT) {}
+
     void run() {
-        initWindow();
+        Clock::time_point startupStart = Clock::now();
+        // There is no window in headless mode, so skip GLFW entirely.
+        if (!settings.headless) {
+            timeStartupPhase("initWindow", [this]() { initWindow(); });
+        }
         initVulkan();
-        mainLoop();
+        startupTotalMs = elapsedMilliseconds(startupStart, Clock::now());
+        recordingStartupPhases = false;
+
+        // Skip rendering if startup was over budget, but still clean up properly before reporting the error.
+        bool withinBudget = reportStartupPhases();
+        if (withinBudget) {
+            mainLoop();
+        }
         cleanup();
+        if (!withinBudget) {
+            throw std::runtime_error("ERROR! Startup exceeded its time budget!");
+        }
     }
 
 private:
+    // Runtime options passed in from the command line.
+    AppSettings settings;
+    // Stdout, even while std::cout is sent to stderr (see main()).
+    std::ostream& reportOut;
+
     // Store reference to a window.
-    GLFWwindow* window;
+    GLFWwindow* window = nullptr;
     // Store the Vulkan instance.
     VkInstance instance;
     // Tell Vulkan about the callback function. Even this needs to be created and destroyed.
     VkDebugUtilsMessengerEXT debugMessenger;
-    // Add a surface class member to help Vulkan interface with the window system
-    VkSurfaceKHR surface;
+    // Add a surface class member to help Vulkan interface with the window system. Stays VK_NULL_HANDLE in headless mode.
+    VkSurfaceKHR surface = VK_NULL_HANDLE;
     // GPU pr other physical device that is picked is stored in this handle
     VkPhysicalDevice physicalDevice = VK_NULL_HANDLE;
+    // Properties (name, limits, etc) of the picked physical device.
+    VkPhysicalDeviceProperties physicalDeviceProperties{};
     // Logical device handle (interfaces with the physical device)
     VkDevice device;
     // Queues are automatically created with the logical device, but we need handles to interface with them.
@@ -99,170 +2600,841 @@ private:
     VkFormat swapChainImageFormat;
     VkExtent2D swapChainExtent;
 
+    // In headless mode the "swap chain" images above are offscreen images that we own, so we also need to hold on to their memory.
+    std::vector<DeviceMemoryAllocator::Allocation> offscreenImageMemory;
+    // Without vkAcquireNextImageKHR, the offscreen images are simply cycled through in order.
+    uint32_t nextOffscreenImage = 0;
+
+    // Hands out the device memory of every buffer and image we create ourselves.
+    DeviceMemoryAllocator memoryAllocator;
+
     // Store the render pass object in this handle.
     VkRenderPass renderPass;
-    // Store the pipeline layout, which is used to pass in uniform values in shaders for example, in this handle.
+    // Store the pipeline layout, which is used to pass in uniform values in shaders for example, in this handle. It's owned by pipelineLayoutCache.
     VkPipelineLayout pipelineLayout;
-    // Store the graphics pipeline in this handle.
+    // Creates pipeline layouts from shader reflection and shares them between pipelines with the same layout.
+    PipelineLayoutCache pipelineLayoutCache;
+    // Store the graphics pipeline in this handle. It's owned by graphicsPipelineCache.
     VkPipeline graphicsPipeline;
+    // Creates graphics pipelines and hands out the existing one when the same state is asked for again.
+    GraphicsPipelineCache graphicsPipelineCache;
+    // The vertices and indices of the triangle, in device local memory (see createVertexBuffers()).
+    VkBuffer vertexBuffer = VK_NULL_HANDLE;
+    DeviceMemoryAllocator::Allocation vertexBufferMemory;
+    VkBuffer indexBuffer = VK_NULL_HANDLE;
+    DeviceMemoryAllocator::Allocation indexBufferMemory;
+    // The state graphicsPipeline was created from, its key in graphicsPipelineCache.
+    GraphicsPipelineDescription graphicsPipelineDescription;
+    // Creates pipelines on worker threads.
+    std::unique_ptr<PipelineCompiler> pipelineCompiler;
+    // Holds the results of pipeline compilation. Seeded from disk at startup and written back at cleanup.
+    VkPipelineCache pipelineCache = VK_NULL_HANDLE;
+    // Mapped shader pack the shaders are loaded from, if --shader-pack is used.
+    ShaderPack shaderPack;
+#ifdef ENABLE_SHADERC
+    // Compiles the GLSL shaders, if --compile-shaders is used.
+    std::unique_ptr<ShaderCompiler> shaderCompiler;
+#endif
 
     // Hold the framebuffers here. They will provide the attachments needed for the render pass. 
     std::vector<VkFramebuffer> swapChainFramebuffers;
 
-    // Store all of the commands buffers in a command pool. They manage the memory that is used to store the buffers.
-    VkCommandPool commandPool;
+    // Store all of the commands buffers in command pools. They manage the memory that is used to store the buffers. Each frame in flight has its own pool, which is reset as a whole when the frame's slot comes around again.
+    std::vector<VkCommandPool> frameCommandPools;
 
-    // Store a command buffer for every image in the swap chain.
+    // Store the command buffer each frame in flight records into. It's allocated once from the frame's pool and re-recorded every frame.
     std::vector<VkCommandBuffer> commandBuffers;
 
+    // Worker threads that record secondary command buffers, if --record-threads is used.
+    std::unique_ptr<WorkerThreadPool> recordingThreads;
+    // Each worker thread has its own command pool for each frame in flight, so threads never share a pool and a frame's pools can be reset while other frames execute. Secondary command buffers are allocated from it as needed and kept for reuse.
+    struct WorkerCommandPool {
+        VkCommandPool pool = VK_NULL_HANDLE;
+        std::vector<VkCommandBuffer> secondaryCommandBuffers;
+        // How many of secondaryCommandBuffers have been recorded since the pool was last reset.
+        uint32_t used = 0;
+    };
+    // Indexed by [frame in flight * thread count + thread index].
+    std::vector<WorkerCommandPool> workerCommandPools;
+    // The secondary command buffers recorded for the current frame, in draw order.
+    std::vector<VkCommandBuffer> frameSecondaryCommandBuffers;
+
     // We need one sem to signal that an image has been gotten and is ready for rendering, and another to signal that rendering has finisehed and presentation can happen for each frame in-flight.
     std::vector<VkSemaphore> imageAvailableSemaphores;
     std::vector<VkSemaphore> renderFinishedSemaphores;
-    // To perform CPU-GPU sync, need to use fences to make sure CPU isn't submitting more than MAX_FRAMES_IN_FLIGHT.
+    // To perform CPU-GPU sync, need to use fences to make sure CPU isn't submitting more than framesInFlight.
     std::vector<VkFence> inFlightFences;
-    // If MAX_FRAMES_IN_FLIGHT > # of swap chain images, or vkAcquireNextImageKHR returns images out-of-order, then we may start rendering to a swap chain image that's already in flight, so need to keep track of each swap chain image if a frame in flight is currently using it.
+    // If framesInFlight > # of swap chain images, or vkAcquireNextImageKHR returns images out-of-order, then we may start rendering to a swap chain image that's already in flight, so need to keep track of each swap chain image if a frame in flight is currently using it.
     std::vector<VkFence> imagesInFlight;
     size_t currentFrame = 0;
 
+    // Number of frames in flight that sync objects are created for. With adaptive frames in flight this is the upper limit, and only the first framesInFlight of them are used at a time.
+    uint32_t frameSlotCount;
+    // Number of frames in flight currently being used.
+    uint32_t framesInFlight;
+    // Picks framesInFlight when it's adaptive.
+    FramesInFlightTuner framesInFlightTuner;
+
+    // Whether the instance has VK_KHR_get_physical_device_properties2, which is needed to query (and enable) features added by extensions.
+    bool physicalDeviceProperties2Enabled = false;
+
+    // With timeline semaphores, one semaphore's counter replaces the per-frame fences. Frame N signals the value N when it finishes on the GPU, so waiting on any earlier frame is a single vkWaitSemaphores call, without any fences to reset.
+    bool timelineSemaphoresEnabled = false;
+    VkSemaphore frameTimelineSemaphore = VK_NULL_HANDLE;
+    // Value signaled by the most recently submitted frame, and the most recent value we've seen the GPU reach.
+    uint64_t lastSubmittedFrameValue = 0;
+    uint64_t lastCompletedFrameValue = 0;
+    // The value of the last frame submitted from each frame in flight, and the last frame that rendered to each swap chain image. With timeline semaphores, these replace inFlightFences and imagesInFlight. With fences, frameTimelineValues is still kept so a signaled fence tells us which frame finished.
+    std::vector<uint64_t> frameTimelineValues;
+    std::vector<uint64_t> imageTimelineValues;
+    // Whether pipelines are linked from VK_EXT_graphics_pipeline_library parts (see createPipelineFromLibraries()), and whether the device says linking without link time optimization is fast.
+    bool pipelineLibrariesEnabled = false;
+    bool pipelineLibraryFastLinking = false;
+    PipelineLibraryCache pipelineLibraryCache;
+    // Link time optimized pipelines being built in the background, to replace the fast-linked pipeline for description.
+    struct OptimizedPipeline {
+        GraphicsPipelineDescription description;
+        std::shared_future<GraphicsPipeline> pipeline;
+    };
+    std::mutex optimizedPipelinesMutex;
+    std::vector<OptimizedPipeline> optimizedPipelines;
+    // Number of fast-linked pipelines that were replaced by their optimized version.
+    uint64_t optimizedPipelineCount = 0;
+    // Whether VK_EXT_pipeline_creation_feedback is enabled, which is whenever the device has it. Every pipeline created is recorded in pipelineCreationStats either way.
+    bool pipelineCreationFeedbackEnabled = false;
+    PipelineCreationStats pipelineCreationStats;
+    // Whether the draws bind shaderObjects (see createShaderObjects()) instead of graphicsPipeline. The state graphicsPipelineDescription describes is then set in the command buffer (see bindShaderObjects()).
+    bool shaderObjectsEnabled = false;
+    ShaderObjects shaderObjects;
+    ShaderObjectFunctions shaderObjectFunctions;
+
+    // VK_KHR_timeline_semaphore functions aren't loaded by default, so look them up once the device is created.
+    PFN_vkWaitSemaphoresKHR waitSemaphoresKHR = nullptr;
+    PFN_vkGetSemaphoreCounterValueKHR getSemaphoreCounterValueKHR = nullptr;
+
+    // Time the current frame has spent blocked waiting on the GPU (in vkWaitForFences, or vkWaitSemaphores with timeline semaphores) so far.
+    double frameFenceWaitMs = 0.0;
+    // Number of frames that have been drawn so far. Used to tell warm-up frames apart from measured frames.
+    uint64_t frameCounter = 0;
+
+    // Timestamp queries used to measure how long the GPU spends on each frame. Each command buffer gets a pair of queries, written before and after its render pass. Stays VK_NULL_HANDLE if GPU timing isn't used/supported.
+    VkQueryPool timestampQueryPool = VK_NULL_HANDLE;
+    // Converts timestamp ticks to nanoseconds.
+    float timestampPeriod = 0.0f;
+    // Only the low timestampValidBits bits of a timestamp are meaningful, so mask off the rest when subtracting.
+    uint64_t timestampMask = 0;
+    // For each frame in flight's query pair, whether results are waiting to be read back and which frame wrote them.
+    struct TimestampQueryPair {
+        bool pending = false;
+        uint64_t frameNumber = 0;
+    };
+    std::vector<TimestampQueryPair> timestampQueries;
+    // Timings of the measured frames of a benchmark run.
+    FrameStatistics frameStats;
+
+    // How long each step of startup took. Names of steps within steps are prefixed with their parent's name, ie "createInstance/vkCreateInstance".
+    struct StartupPhase {
+        std::string name;
+        double ms;
+        // 0 for the steps of initVulkan(), 1 for steps within those, etc.
+        uint32_t depth;
+    };
+    std::vector<StartupPhase> startupPhases;
+    // Prefix for the names of steps started inside the current one.
+    std::string startupPhasePrefix;
+    // Steps are only timed during startup, not when they run again later (ie createGraphicsPipeline() during swap chain recreation).
+    bool recordingStartupPhases = true;
+    // Steps are only timed on the thread that runs startup. Steps on worker threads (ie compiling pipelines) overlap each other, so they'd add up to more than the time they actually took.
+    std::thread::id startupThreadId = std::this_thread::get_id();
+    // Time from the start of run() until initVulkan() finished.
+    double startupTotalMs = 0.0;
+
+    // Set by the GLFW callback when the window is resized, since not every driver reports VK_ERROR_OUT_OF_DATE_KHR when that happens.
+    bool framebufferResized = false;
+    // Objects that were replaced (ie by swap chain recreation) but may still be used by frames in flight. Each one is destroyed once the GPU finishes frame frameValue, so nothing ever has to wait for the whole device to go idle.
+    struct DeferredDeletion {
+        uint64_t frameValue;
+        std::function<void()> destroy;
+    };
+    std::deque<DeferredDeletion> deferredDeletions;
+
+    // Watches shaders/ for the hot reload.
+    DirectoryWatcher shaderWatcher;
+    // A pipeline built in the background, and what it was built from.
+    struct PipelineBuild {
+        GraphicsPipelineDescription description;
+        GraphicsPipeline pipeline;
+        // Built instead of the pipeline when shaderObjectsEnabled.
+        ShaderObjects shaderObjects;
+    };
+    // The pipeline being rebuilt in the background, if any.
+    std::future<PipelineBuild> pipelineRebuild;
+    // Shaders changed (again) while nothing was rebuilding (or while a rebuild was already running), so start one.
+    bool pipelineRebuildRequested = false;
+
 
 
     // ~~~~~~~~~~~~~~~ Initialization, Main loop, & Cleanup ~~~~~~~~~~~~~~~~~~~
     // ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
     // Initialize GLFW and create a window.
     void initWindow() {
+        PROFILE_ZONE("initWindow");
         // initializes the GLFW library
         glfwInit();
 
         // Because GLFW was originally designed to create an OpenGL context, need to tell it not to.
         glfwWindowHint(GLFW_CLIENT_API, GLFW_NO_API);
-        // Handling windows takes special care that we'll do later, so disable it for now.
-        glfwWindowHint(GLFW_RESIZABLE, GLFW_FALSE);
-
         // Create the actual window (width, height, title, optional monitor, last param only relevant to OpenGL)
         window = glfwCreateWindow(WIDTH, HEIGHT, "Vulkan", nullptr, nullptr);
+
+        // The window is resizable, so get told when that happens. GLFW callbacks can't be member functions, so store a pointer to this app in the window to get back to it.
+        glfwSetWindowUserPointer(window, this);
+        glfwSetFramebufferSizeCallback(window, framebufferResizeCallback);
+    }
+
+    // Called by GLFW when the window's framebuffer changes size. The swap chain gets recreated on the next frame.
+    static void framebufferResizeCallback(GLFWwindow* window, int /*width*/, int /*height*/) {
+        auto app = reinterpret_cast<HelloTriangleApplication*>(glfwGetWindowUserPointer(window));
+        app->framebufferResized = true;
     }
 
     // Calls funcs to initiate Vulkan objects.
     void initVulkan() {
+        PROFILE_ZONE("initVulkan");
         // Very first thing to init Vulkan library is by creating an instance.
-        createInstance();
+        timeStartupPhase("createInstance", [this]() { createInstance(); });
         std::cout << "\n{########## Vulkan instance created. ##########}\n";
 
         // Then, get the validation layers callback working by setting up the debug messenger
-        setupDebugMessenger();
+        timeStartupPhase("setupDebugMessenger", [this]() { setupDebugMessenger(); });
         std::cout << "\n{########## Debug messenger setup. ##########}\n";
 
-        // Create a surface for Vulkan to interface with the window system.
-        createSurface();
-        std::cout << "\n{########## VkSurfaceKHR object created. ##########}\n";
+        // Create a surface for Vulkan to interface with the window system. Not needed in headless mode, since nothing gets presented.
+        if (!settings.headless) {
+            timeStartupPhase("createSurface", [this]() { createSurface(); });
+            std::cout << "\n{########## VkSurfaceKHR object created. ##########}\n";
+        }
 
         // Pick a GPU that supports the features we need
-        pickPhysicalDevice();
+        timeStartupPhase("pickPhysicalDevice", [this]() { pickPhysicalDevice(); });
         std::cout << "\n{########## Physical device picked. ##########}\n";
 
         // Once the physical device is chosen, need to use a logical device to interface with it.
-        createLogicalDevice();
+        timeStartupPhase("createLogicalDevice", [this]() { createLogicalDevice(); });
         std::cout << "\n{########## Logical device created. ##########}\n";
 
+        // Everything that needs device memory (offscreen images, vertex and index buffers) gets it from the allocator.
+        memoryAllocator.init(physicalDevice, device);
+
         // Once the logical device is created to interface with a physical device, and after we've confirmed a swap chain is available (during isDeviceSuitable()), create a swap chain with the best possible settings (surface format, presentation mode, and swap extent)
-        createSwapChain();
-        std::cout << "\n{########## Swap chain created. ##########}\n";
+        // In headless mode, create offscreen images to stand in for the swap chain images instead. Everything after this works off of swapChainImages, swapChainImageFormat and swapChainExtent, so the rest of the renderer is shared.
+        if (settings.headless) {
+            timeStartupPhase("createOffscreenTargets", [this]() { createOffscreenTargets(); });
+            std::cout << "\n{########## Offscreen render targets created. ##########}\n";
+        }
+        else {
+            timeStartupPhase("createSwapChain", [this]() { createSwapChain(); });
+            std::cout << "\n{########## Swap chain created. ##########}\n";
+        }
 
         // Once the swap chain is created, create image views for the images stored within.
-        createImageViews();
+        timeStartupPhase("createImageViews", [this]() { createImageViews(); });
         std::cout << "\n{########## Image views created. ##########}\n";
 
         // Tell Vulkan about the framebuffer attachments that will be used while rendering through a render pass object.
-        createRenderPass();
+        timeStartupPhase("createRenderPass", [this]() { createRenderPass(); });
         std::cout << "\n{########## Render pass created. ##########}\n";
 
+        // Map the shader pack, if the shaders come from one.
+        if (!settings.shaderPackPath.empty()) {
+            timeStartupPhase("openShaderPack", [this]() { shaderPack.open(settings.shaderPackPath); });
+            std::cout << "\n{########## Shader pack opened. ##########}\n";
+        }
+
+        // Load the pipeline cache from the last run, so the pipeline below doesn't have to be compiled from scratch.
+        timeStartupPhase("createPipelineCache", [this]() { createPipelineCache(); });
+        std::cout << "\n{########## Pipeline cache created. ##########}\n";
+        // Start the threads that compile pipelines.
+        timeStartupPhase("createPipelineCompiler", [this]() { createPipelineCompiler(); });
+
         // Now that the Image views are created, there needs to be a pipeline the input data goes through
-        createGraphicsPipeline();
+        timeStartupPhase("createGraphicsPipeline", [this]() { createGraphicsPipeline(); });
         std::cout << "\n{########## Graphics pipeline created. ##########}\n";
 
         // Now, create framebuffers so the render pass can get the attachments from the swapchain.
-        createFramebuffers();
+        timeStartupPhase("createFramebuffers", [this]() { createFramebuffers(); });
         std::cout << "\n{########## Framebuffers created. ##########}\n";
 
-        // Create a command pool to hold command buffer objects.
-        createCommandPool();
-        std::cout << "\n{########## Command pool created. ##########}\n";
+        // Create a command pool for each frame in flight to hold command buffer objects.
+        timeStartupPhase("createCommandPools", [this]() { createCommandPools(); });
+        std::cout << "\n{########## Command pools created. ##########}\n";
+
+        // Upload the triangle's vertices and indices into buffers the GPU reads from directly.
+        timeStartupPhase("createVertexBuffers", [this]() { createVertexBuffers(); });
+        std::cout << "\n{########## Vertex and index buffers created. ##########}\n";
 
-        // Create a command pool to hold command buffer objects.
-        createCommandBuffers();
+        // Create the timestamp queries that the command buffers write to, so GPU time per frame can be measured.
+        timeStartupPhase("createTimestampQueryPool", [this]() { createTimestampQueryPool(); });
+
+        // Allocate the command buffer each frame in flight records into.
+        timeStartupPhase("createCommandBuffers", [this]() { createCommandBuffers(); });
         std::cout << "\n{########## Command buffers created. ##########}\n";
 
+        // Start the worker threads and give each one its own command pools to record secondary command buffers from.
+        if (settings.recordThreads > 0) {
+            timeStartupPhase("createRecordingThreads", [this]() { createRecordingThreads(); });
+            std::cout << "\n{########## Recording threads created. ##########}\n";
+        }
+
         // Create semaphores to sync queue operations of draw commands and presentation. And create fences to sync up the CPU and GPU.
-        createSyncObjects();
+        timeStartupPhase("createSyncObjects", [this]() { createSyncObjects(); });
         std::cout << "\n{########## Semaphores and fences created. ##########}\n";
+
+        // Start watching the shaders, so they can be changed without restarting.
+        if (settings.hotReload) {
+            startShaderHotReload();
+        }
     }
 
 
     // Iterates until the window is closed.
     void mainLoop() {
-        // loops and checks for events like pressing the Close/X button.
-        while (!glfwWindowShouldClose(window)) {
-            glfwPollEvents();
+        // Windowed runs go until the window is closed. There's no window to close in headless mode, so just render a fixed amount of frames. Benchmark runs render the warm-up frames and then the measured frames.
+        uint64_t frameLimit = UINT64_MAX;
+        if (settings.benchmark) {
+            frameLimit = static_cast<uint64_t>(settings.warmupFrames) + settings.benchmarkFrames;
+            frameStats.reserve(settings.benchmarkFrames);
+        }
+        else if (settings.headless) {
+            frameLimit = settings.headlessFrameCount;
+        }
+
+        for (frameCounter = 0; frameCounter < frameLimit; frameCounter++) {
+            PROFILE_ZONE("frame");
+            Clock::time_point frameStart = Clock::now();
+            frameFenceWaitMs = 0.0;
+
+            // loops and checks for events like pressing the Close/X button.
+            if (!settings.headless) {
+                PROFILE_ZONE("pollEvents");
+                if (glfwWindowShouldClose(window)) {
+                    break;
+                }
+                glfwPollEvents();
+            }
+            // Swap in a rebuilt pipeline (at the frame boundary, so no command buffer is half recorded with the old one), and start rebuilds for changed shaders.
+            if (settings.hotReload) {
+                updateShaderHotReload();
+            }
+            // Same for link time optimized pipelines that finished building.
+            if (pipelineLibrariesEnabled) {
+                updateOptimizedPipelines();
+            }
             drawFrame();
+
+            double frameTimeMs = elapsedMilliseconds(frameStart, Clock::now());
+            if (isMeasuredFrame(frameCounter)) {
+                frameStats.recordFrame(frameTimeMs, frameFenceWaitMs);
+            }
+            if (settings.adaptiveFramesInFlight) {
+                setFramesInFlight(framesInFlightTuner.recordFrame(frameTimeMs, frameFenceWaitMs));
+            }
         }
         // All of the drawFrame ops are async, meaning when we exit the loop drawing and presentation might still be going on, so wait until the logical device finishes operations before exiting mainLoop and destroying the window.
-        vkDeviceWaitIdle(device);
+        {
+            PROFILE_ZONE("vkDeviceWaitIdle");
+            vkDeviceWaitIdle(device);
+        }
+
+        if (settings.benchmark) {
+            // The GPU is idle now, so pick up the timestamps of the last few frames that were still in flight when the loop ended.
+            for (uint32_t i = 0; i < timestampQueries.size(); i++) {
+                collectGpuTimestamps(i);
+            }
+            writeBenchmarkReport();
+        }
     }
 
     // Deallocate resources. In C++ it's possible to perform automatic resource management like using RAII, but in this tutorial, it will be explicitly done.
     void cleanup() {
-        // Destroy the semaphores for syncing operations across command queues and the fences for syncing CPU and GPU workloads.
-        for (size_t i = 0; i < MAX_FRAMES_IN_FLIGHT; i++) {
+        PROFILE_ZONE("cleanup");
+        // Let a pipeline rebuild that's still running finish. What it built is in the pipeline cache, which is destroyed below.
+        if (pipelineRebuild.valid()) {
+            pipelineRebuild.wait();
+            // Shader objects aren't cached, so ones that were never swapped in have to be destroyed here.
+            if (shaderObjectsEnabled) {
+                try {
+                    PipelineBuild build = pipelineRebuild.get();
+                    shaderObjectFunctions.destroyShader(device, build.shaderObjects.vertex, nullptr);
+                    shaderObjectFunctions.destroyShader(device, build.shaderObjects.fragment, nullptr);
+                }
+                catch (const std::exception&) {
+                }
+            }
+        }
+
+        // Finish any queued pipeline compiles and stop the compiler threads. Optimized pipelines that never got swapped in aren't in the pipeline cache, so destroy them here.
+        pipelineCompiler.reset();
+        for (auto& optimized : optimizedPipelines) {
+            try {
+                vkDestroyPipeline(device, optimized.pipeline.get().pipeline, nullptr);
+            }
+            catch (const std::exception&) {
+            }
+        }
+        optimizedPipelines.clear();
+
+        // The device is idle by now, so anything still waiting to be retired can go.
+        flushDeferredDeletions();
+
+        // Destroy the semaphores for syncing operations across command queues and the fences (or timeline semaphore) for syncing CPU and GPU workloads.
+        for (size_t i = 0; i < frameSlotCount; i++) {
             vkDestroySemaphore(device, renderFinishedSemaphores[i], nullptr);
             vkDestroySemaphore(device, imageAvailableSemaphores[i], nullptr);
-            vkDestroyFence(device, inFlightFences[i], nullptr);
+        }
+        for (auto fence : inFlightFences) {
+            vkDestroyFence(device, fence, nullptr);
+        }
+        if (frameTimelineSemaphore != VK_NULL_HANDLE) {
+            vkDestroySemaphore(device, frameTimelineSemaphore, nullptr);
         }
 
-        // Destroy the command pool which holds the command buffers.
-        vkDestroyCommandPool(device, commandPool, nullptr);
+        // Stop the worker threads, and destroy the command pools which hold the command buffers. This also frees the command buffers.
+        recordingThreads.reset();
+        for (auto& workerPool : workerCommandPools) {
+            vkDestroyCommandPool(device, workerPool.pool, nullptr);
+        }
+        for (auto pool : frameCommandPools) {
+            vkDestroyCommandPool(device, pool, nullptr);
+        }
+
+        // Destroy the timestamp queries that were written by the command buffers.
+        if (timestampQueryPool != VK_NULL_HANDLE) {
+            vkDestroyQueryPool(device, timestampQueryPool, nullptr);
+        }
 
         // Destroy all the framebuffers that reference image views which describe attachments needed for the render pass.
         for (auto framebuffer : swapChainFramebuffers) {
             vkDestroyFramebuffer(device, framebuffer, nullptr);
         }
 
-        // Destroy the graphics pipeline.
-        vkDestroyPipeline(device, graphicsPipeline, nullptr);
+        // Destroy the vertex and index buffers, and free their memory.
+        vkDestroyBuffer(device, indexBuffer, nullptr);
+        memoryAllocator.free(indexBufferMemory);
+        vkDestroyBuffer(device, vertexBuffer, nullptr);
+        memoryAllocator.free(vertexBufferMemory);
+
+        // Destroy the graphics pipelines, or the shader objects drawn with instead.
+        if (shaderObjectsEnabled) {
+            shaderObjectFunctions.destroyShader(device, shaderObjects.vertex, nullptr);
+            shaderObjectFunctions.destroyShader(device, shaderObjects.fragment, nullptr);
+        }
+        graphicsPipelineCache.destroy(device);
+        pipelineLibraryCache.destroy(device);
+
+        // Destroy the pipeline layouts (and their descriptor set layouts) that are used to send uniform values and push constants to the graphics pipelines.
+        pipelineLayoutCache.destroy(device);
+
+        // Save the pipeline cache to disk for the next run, and then destroy it.
+        savePipelineCache();
+        vkDestroyPipelineCache(device, pipelineCache, nullptr);
+
+        // No more pipelines will be created, so the shader pack can be unmapped.
+        shaderPack.close();
+
+        // Destroy the render pass object which describes to Vulkan about framebuffer attachments and how to handle data.
+        vkDestroyRenderPass(device, renderPass, nullptr);
+
+        // Destroy the VkImageView objects used for the VkImage objects within the swap chain.
+        for (auto imageView : swapChainImageViews) {
+            vkDestroyImageView(device, imageView, nullptr);
+        }
+
+        // Destroy the swap chain before you destroy the logical device (since the swap chain is used by the logical device). In headless mode, the images are ours to destroy along with their memory.
+        if (settings.headless) {
+            destroyOffscreenTargets();
+        }
+        else {
+            vkDestroySwapchainKHR(device, swapChain, nullptr);
+        }
+
+        // Every buffer and image is gone, so free the device memory blocks they were allocated from.
+        memoryAllocator.destroy();
+
+        // Destroy the logical device which interacts with the chosen physical device. 
+        vkDestroyDevice(device, nullptr);
+
+        // Destroy the VkDebugUtilsMessengerEXT object
+        if (enableValidationLayers) {
+            DestroyDebugUtilsMessengerEXT(instance, debugMessenger, nullptr);
+        }
+
+        // Destroy the surface created in createSurface()
+        if (surface != VK_NULL_HANDLE) {
+            vkDestroySurfaceKHR(instance, surface, nullptr);
+        }
+
+        // VkInstance should be destroyed right before program exits, ignore the optional callback param.
+        vkDestroyInstance(instance, nullptr);
+
+        // Headless mode never initialized GLFW.
+        if (!settings.headless) {
+            // Once window is closed, must destroy it.
+            glfwDestroyWindow(window);
+
+            // Terminate glfw itself
+            glfwTerminate();
+        }
+    }
+    // ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+
+
+
+    // ~~~~~~~~~~~~~~~~~~~~~~~~~~ Shader Hot Reload ~~~~~~~~~~~~~~~~~~~~~~~~~~~
+    // ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+
+    // Start watching shaders/. Hot reload only works when the shaders are loaded from files, not from a shader pack or the executable.
+    void startShaderHotReload() {
+        bool loadsShaderFiles = settings.compileShaders;
+#ifndef EMBEDDED_SPIRV
+        loadsShaderFiles = loadsShaderFiles || !shaderPack.isOpen();
+#endif
+        if (!loadsShaderFiles) {
+            std::cout << "WARNING: Shader hot reload needs shaders loaded from files (not a shader pack or embedded SPIR-V), so it's disabled.\n";
+            settings.hotReload = false;
+            return;
+        }
+        if (!shaderWatcher.watch("shaders")) {
+            std::cout << "WARNING: Can't watch the shaders directory (hot reload needs Linux/inotify), so shader hot reload is disabled.\n";
+            settings.hotReload = false;
+            return;
+        }
+        std::cout << "Watching shaders/ for changes.\n";
+    }
+
+    // Whether a changed file in shaders/ is one the pipeline is built from.
+    bool isWatchedShaderFile(const std::string& fileName) {
+        for (const ShaderSource* shader : { &VERTEX_SHADER, &FRAGMENT_SHADER }) {
+            // spvPath includes the directory, the watcher only reports names.
+            std::string spvName = std::filesystem::path(shader->spvPath).filename().string();
+            if (fileName == (settings.compileShaders ? shader->name : spvName)) {
+                return true;
+            }
+        }
+        return false;
+    }
+
+    /* Called once per frame, before drawFrame(). Starts a background rebuild when the shaders change, and once it's
+    done, swaps the new pipeline in. The old pipeline may still be used by frames in flight, so it's handed to
+    deferDestroy() and destroyed once they're done. If the new shaders don't compile, the old pipeline is kept.*/
+    void updateShaderHotReload() {
+        PROFILE_ZONE("updateShaderHotReload");
+        std::vector<std::string> changedFiles;
+        if (shaderWatcher.poll(changedFiles)) {
+            for (const auto& fileName : changedFiles) {
+                if (isWatchedShaderFile(fileName)) {
+                    pipelineRebuildRequested = true;
+                }
+            }
+        }
+
+        if (pipelineRebuild.valid() && pipelineRebuild.wait_for(std::chrono::seconds(0)) == std::future_status::ready) {
+            try {
+                PipelineBuild build = pipelineRebuild.get();
+                if (shaderObjectsEnabled) {
+                    swapShaderObjects(build);
+                }
+                else {
+                    // A fast-linked pipeline may already have been replaced by its optimized version, so use whatever the cache has now.
+                    graphicsPipelineCache.find(build.description, build.pipeline);
+                    if (build.pipeline.pipeline == graphicsPipeline) {
+                        // The shaders were saved without changing (the cache handed back the current pipeline).
+                        std::cout << "Shaders unchanged.\n";
+                    }
+                    else {
+                        retireGraphicsPipeline();
+                        graphicsPipelineDescription = build.description;
+                        graphicsPipeline = build.pipeline.pipeline;
+                        pipelineLayout = build.pipeline.layout;
+                        std::cout << "Shaders reloaded.\n";
+                    }
+                }
+            }
+            catch (const std::exception& e) {
+                std::cerr << e.what() << "\nKeeping the previous shaders.\n";
+            }
+        }
+
+        // Only one rebuild at a time. Changes made during a rebuild start another one once it's done.
+        if (pipelineRebuildRequested && !pipelineRebuild.valid()) {
+            pipelineRebuildRequested = false;
+            pipelineRebuild = std::async(std::launch::async, [this]() {
+                PROFILE_ZONE("rebuildPipeline");
+                PipelineBuild build;
+                ShaderCode vertShaderCode = loadShaderCode(VERTEX_SHADER);
+                ShaderCode fragShaderCode = loadShaderCode(FRAGMENT_SHADER);
+                build.description = describeGraphicsPipeline(vertShaderCode, fragShaderCode);
+                if (shaderObjectsEnabled) {
+                    build.shaderObjects = createShaderObjects(vertShaderCode, fragShaderCode, build.description);
+                }
+                else {
+                    build.pipeline = getGraphicsPipeline(vertShaderCode, fragShaderCode, build.description);
+                }
+                return build;
+            });
+        }
+    }
+
+    // Swap in rebuilt shader objects. There's no cache to hand back the current ones, so unchanged shaders come back as new objects, which are never used.
+    void swapShaderObjects(const PipelineBuild& build) {
+        if (build.description == graphicsPipelineDescription) {
+            shaderObjectFunctions.destroyShader(device, build.shaderObjects.vertex, nullptr);
+            shaderObjectFunctions.destroyShader(device, build.shaderObjects.fragment, nullptr);
+            std::cout << "Shaders unchanged.\n";
+            return;
+        }
+        retireShaderObjects(shaderObjects);
+        graphicsPipelineDescription = build.description;
+        shaderObjects = build.shaderObjects;
+        pipelineLayout = shaderObjects.layout;
+        std::cout << "Shaders reloaded.\n";
+    }
+    // ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+
+
+
+    // ~~~~~~~~~~~~~~~~~~~~~~~~~~~~ Startup Timing ~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+    // ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+
+    // Run one step of startup and record how long it took. Steps can be nested, ie to time vkCreateInstance inside createInstance(). After startup this just runs the step.
+    template <typename Step>
+    void timeStartupPhase(const char* name, Step&& step) {
+        if (!recordingStartupPhases || std::this_thread::get_id() != startupThreadId) {
+            step();
+            return;
+        }
+
+        std::string fullName = startupPhasePrefix + name;
+        uint32_t depth = static_cast<uint32_t>(std::count(startupPhasePrefix.begin(), startupPhasePrefix.end(), '/'));
+        std::string parentPrefix = startupPhasePrefix;
+        startupPhasePrefix = fullName + "/";
+
+        Clock::time_point start = Clock::now();
+        step();
+        startupPhases.push_back({ fullName, elapsedMilliseconds(start, Clock::now()), depth });
+        startupPhasePrefix = parentPrefix;
+    }
+
+    // Print the startup steps sorted slowest first, if asked for, and check them against their budgets. Returns false if any step went over its budget.
+    bool reportStartupPhases() {
+        if (!settings.startupReport && settings.startupBudgets.empty()) {
+            return true;
+        }
+
+        std::vector<StartupPhase> sorted = startupPhases;
+        std::stable_sort(sorted.begin(), sorted.end(), [](const StartupPhase& a, const StartupPhase& b) { return a.ms > b.ms; });
+        sorted.push_back({ "total", startupTotalMs, 0 });
+
+        bool withinBudget = true;
+        std::cout << "\nStartup phases (slowest first, nested steps are also counted in their parent):\n~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~\n";
+        std::cout << std::left << std::setw(48) << "Phase" << std::right << std::setw(12) << "ms" << std::setw(9) << "%" << std::setw(12) << "budget" << "\n";
+        for (const auto& phase : sorted) {
+            std::cout << std::left << std::setw(48) << phase.name << std::right << std::fixed << std::setprecision(3) << std::setw(12) << phase.ms
+                << std::setprecision(1) << std::setw(8) << (startupTotalMs > 0.0 ? 100.0 * phase.ms / startupTotalMs : 0.0) << "%";
+            for (const auto& budget : settings.startupBudgets) {
+                if (budget.first == phase.name) {
+                    bool over = phase.ms > budget.second;
+                    withinBudget = withinBudget && !over;
+                    std::cout << std::setprecision(3) << std::setw(12) << budget.second << (over ? "  OVER BUDGET" : "");
+                }
+            }
+            std::cout << "\n";
+        }
+        std::cout << std::defaultfloat;
+
+        // A budget for a step that never ran is most likely a typo, so say so instead of silently passing.
+        for (const auto& budget : settings.startupBudgets) {
+            bool found = std::any_of(sorted.begin(), sorted.end(), [&](const StartupPhase& phase) { return phase.name == budget.first; });
+            if (!found) {
+                std::cout << "WARNING: No startup phase named " << budget.first << ", its budget was not checked.\n";
+            }
+        }
+        return withinBudget;
+    }
+    // ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+
+
+
+    // ~~~~~~~~~~~~~~~~~~~~~~~~~~~~ Benchmarking ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+    // ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+
+    // Wraps vkWaitForFences to keep track of how long the CPU spends blocked waiting on the GPU during a frame.
+    void waitForFence(const VkFence& fence) {
+        Clock::time_point waitStart = Clock::now();
+        vkWaitForFences(device, 1, &fence, VK_TRUE, UINT64_MAX);
+        frameFenceWaitMs += elapsedMilliseconds(waitStart, Clock::now());
+    }
+
+    // Whether the frame with the given number is one of the measured frames of a benchmark run (as opposed to a warm-up frame).
+    bool isMeasuredFrame(uint64_t frameNumber) {
+        return settings.benchmark && frameNumber >= settings.warmupFrames;
+    }
+
+    // Create the query pool for the GPU timestamps. GPU timing is only used for benchmark runs, and needs the graphics queue to support timestamps.
+    void createTimestampQueryPool() {
+        PROFILE_ZONE("createTimestampQueryPool");
+        if (!settings.benchmark) {
+            return;
+        }
+
+        // timestampValidBits is 0 if the queue family doesn't support timestamps at all.
+        QueueFamilyIndices indices = findQueueFamilies(physicalDevice);
+        uint32_t queueFamilyCount = 0;
+        vkGetPhysicalDeviceQueueFamilyProperties(physicalDevice, &queueFamilyCount, nullptr);
+        std::vector<VkQueueFamilyProperties> queueFamilies(queueFamilyCount);
+        vkGetPhysicalDeviceQueueFamilyProperties(physicalDevice, &queueFamilyCount, queueFamilies.data());
+        uint32_t validBits = queueFamilies[indices.graphicsFamily.value()].timestampValidBits;
+        if (validBits == 0) {
+            std::cout << "Graphics queue doesn't support timestamps, GPU frame times won't be reported.\n";
+            return;
+        }
+        timestampMask = validBits >= 64 ? UINT64_MAX : ((uint64_t(1) << validBits) - 1);
+        timestampPeriod = physicalDeviceProperties.limits.timestampPeriod;
 
-        // Destroy the pipeline layout that is used to send uniform values and push constants to the graphics pipeline.
-        vkDestroyPipelineLayout(device, pipelineLayout, nullptr);
+        // One pair of queries (start and end) for each command buffer, which is one per frame in flight.
+        timestampQueries.assign(frameSlotCount, TimestampQueryPair{});
 
-        // Destroy the render pass object which describes to Vulkan about framebuffer attachments and how to handle data.
-        vkDestroyRenderPass(device, renderPass, nullptr);
+        VkQueryPoolCreateInfo queryPoolInfo{};
+        queryPoolInfo.sType = VK_STRUCTURE_TYPE_QUERY_POOL_CREATE_INFO;
+        queryPoolInfo.queryType = VK_QUERY_TYPE_TIMESTAMP;
+        queryPoolInfo.queryCount = static_cast<uint32_t>(2 * timestampQueries.size());
 
-        // Destroy the VkImageView objects used for the VkImage objects within the swap chain.
-        for (auto imageView : swapChainImageViews) {
-            vkDestroyImageView(device, imageView, nullptr);
+        if (vkCreateQueryPool(device, &queryPoolInfo, nullptr, &timestampQueryPool) != VK_SUCCESS) {
+            throw std::runtime_error("ERROR! Failed to create timestamp query pool!");
         }
+    }
 
-        // Destroy the swap chain before you destroy the logical device (since the swap chain is used by the logical device).
-        vkDestroySwapchainKHR(device, swapChain, nullptr);
-
-        // Destroy the logical device which interacts with the chosen physical device. 
-        // Destroy the logical device which interacts with the chosen physical device. 
-        vkDestroyDevice(device, nullptr);
+    // Read back the GPU time of the frame that last used this command buffer's query pair. Only called once a fence has told us the GPU is done with that frame, so the results are already available and this never stalls.
+    void collectGpuTimestamps(size_t commandBufferIndex) {
+        if (timestampQueryPool == VK_NULL_HANDLE || commandBufferIndex >= timestampQueries.size() || !timestampQueries[commandBufferIndex].pending) {
+            return;
+        }
 
-        // Destroy the VkDebugUtilsMessengerEXT object
-        if (enableValidationLayers) {
-            DestroyDebugUtilsMessengerEXT(instance, debugMessenger, nullptr);
+        uint64_t timestamps[2];
+        // No VK_QUERY_RESULT_WAIT_BIT, so this returns VK_NOT_READY instead of blocking if the results somehow aren't there yet.
+        VkResult result = vkGetQueryPoolResults(device, timestampQueryPool, static_cast<uint32_t>(2 * commandBufferIndex), 2, sizeof(timestamps), timestamps, sizeof(uint64_t), VK_QUERY_RESULT_64_BIT);
+        if (result != VK_SUCCESS) {
+            return;
         }
+        timestampQueries[commandBufferIndex].pending = false;
 
-        // Destroy the surface created in createSurface()
-        vkDestroySurfaceKHR(instance, surface, nullptr);
+        if (isMeasuredFrame(timestampQueries[commandBufferIndex].frameNumber)) {
+            uint64_t ticks = (timestamps[1] - timestamps[0]) & timestampMask;
+            frameStats.gpuFrameTimesMs.push_back(ticks * static_cast<double>(timestampPeriod) / 1e6);
+        }
+    }
 
-        // VkInstance should be destroyed right before program exits, ignore the optional callback param.
-        vkDestroyInstance(instance, nullptr);
+    /* The pipeline creation feedback part of the benchmark report: one entry per pipeline created (in the order they were
+    created), with the driver's time per stage and the SPIR-V hash of each stage's shader, plus how many of them were
+    pipeline cache hits.*/
+    void writePipelineCreationReport(std::ostream& out) {
+        std::vector<PipelineCreationStats::Record> records = pipelineCreationStats.getRecords();
+        out << "  \"pipeline_creation_feedback\": " << (pipelineCreationFeedbackEnabled ? "true" : "false") << ",\n";
+        out << "  \"pipeline_creation_cache_hits\": " << pipelineCreationStats.getCacheHitCount() << ",\n";
+        out << "  \"pipeline_creation\": [";
+        for (size_t i = 0; i < records.size(); i++) {
+            const auto& record = records[i];
+            out << (i > 0 ? "," : "") << "\n    {\"kind\": \"" << record.kind << "\", \"feedback\": " << (record.feedback ? "true" : "false")
+                << ", \"ms\": " << record.ms << ", \"cache_hit\": " << (record.cacheHit ? "true" : "false") << ", \"stages\": [";
+            for (size_t j = 0; j < record.stages.size(); j++) {
+                const auto& stage = record.stages[j];
+                std::ostringstream shaderHash;
+                shaderHash << std::hex << std::setw(16) << std::setfill('0') << stage.shaderHash;
+                out << (j > 0 ? ", " : "") << "{\"stage\": \"" << (stage.stage == VK_SHADER_STAGE_VERTEX_BIT ? "vert" : stage.stage == VK_SHADER_STAGE_FRAGMENT_BIT ? "frag" : "other")
+                    << "\", \"shader\": \"" << shaderHash.str() << "\", \"ms\": " << stage.ms << ", \"cache_hit\": " << (stage.cacheHit ? "true" : "false") << "}";
+            }
+            out << "]}";
+        }
+        out << (records.empty() ? "" : "\n  ") << "],\n";
+    }
 
-        // Once window is closed, must destroy it.
-        glfwDestroyWindow(window);
+    // Summarize the measured frames and write them out as JSON, either to stdout or to the file given on the command line.
+    void writeBenchmarkReport() {
+        PROFILE_ZONE("writeBenchmarkReport");
+        // Formatted on its own stream, so the number formatting doesn't stick to stdout.
+        std::ostringstream out;
+
+        TimingSummary cpuFrameTime = TimingSummary::fromSamples(frameStats.cpuFrameTimesMs);
+        TimingSummary fenceWait = TimingSummary::fromSamples(frameStats.fenceWaitTimesMs);
+        TimingSummary gpuFrameTime = TimingSummary::fromSamples(frameStats.gpuFrameTimesMs);
+        // If the window was closed early, fewer frames than requested were measured.
+        size_t measuredFrames = frameStats.cpuFrameTimesMs.size();
+        double fps = cpuFrameTime.total > 0.0 ? measuredFrames / (cpuFrameTime.total / 1000.0) : 0.0;
+
+        out << std::fixed << std::setprecision(4);
+        out << "{\n";
+        out << "  \"device\": \"" << escapeJson(physicalDeviceProperties.deviceName) << "\",\n";
+        out << "  \"headless\": " << (settings.headless ? "true" : "false") << ",\n";
+        out << "  \"extent\": [" << swapChainExtent.width << ", " << swapChainExtent.height << "],\n";
+        out << "  \"frames_in_flight\": " << framesInFlight << ",\n";
+        out << "  \"frames_in_flight_mode\": \"" << (settings.adaptiveFramesInFlight ? "adaptive" : "fixed") << "\",\n";
+        out << "  \"frames_in_flight_changes\": " << framesInFlightTuner.getChangeCount() << ",\n";
+        out << "  \"startup_ms\": {";
+        for (const auto& phase : startupPhases) {
+            out << "\"" << phase.name << "\": " << phase.ms << ", ";
+        }
+        out << "\"total\": " << startupTotalMs << "},\n";
+        out << "  \"record_threads\": " << settings.recordThreads << ",\n";
+        out << "  \"draws_per_frame\": " << settings.drawCount << ",\n";
+        out << "  \"pipeline_layouts\": " << pipelineLayoutCache.getPipelineLayoutCount() << ",\n";
+        out << "  \"descriptor_set_layouts\": " << pipelineLayoutCache.getSetLayoutCount() << ",\n";
+        out << "  \"pipeline_layout_cache_hits\": " << pipelineLayoutCache.getHitCount() << ",\n";
+        out << "  \"compile_threads\": " << (pipelineCompiler ? pipelineCompiler->getThreadCount() : 0) << ",\n";
+        out << "  \"pipeline_libraries\": " << (pipelineLibrariesEnabled ? "true" : "false") << ",\n";
+        out << "  \"pipeline_library_parts\": " << pipelineLibraryCache.getLibraryCount() << ",\n";
+        out << "  \"optimized_pipelines\": " << optimizedPipelineCount << ",\n";
+        out << "  \"render_backend\": \"" << (shaderObjectsEnabled ? "shader_objects" : "pipeline") << "\",\n";
+        out << "  \"pipelines\": " << graphicsPipelineCache.getPipelineCount() << ",\n";
+        out << "  \"pipeline_state_cache_hits\": " << graphicsPipelineCache.getHitCount() << ",\n";
+        out << "  \"pipeline_state_cache_misses\": " << graphicsPipelineCache.getMissCount() << ",\n";
+        writePipelineCreationReport(out);
+        DeviceMemoryAllocator::Statistics memory = memoryAllocator.getStatistics();
+        out << "  \"device_memory\": {\"vk_allocations\": " << memory.deviceMemoryCount << ", \"blocks\": " << memory.blockCount
+            << ", \"block_bytes\": " << memory.blockBytes << ", \"dedicated_allocations\": " << memory.dedicatedCount << ", \"dedicated_bytes\": " << memory.dedicatedBytes
+            << ", \"allocations\": " << memory.allocationCount << ", \"used_bytes\": " << memory.usedBytes << ", \"reserved_bytes\": " << memory.reservedBytes
+            << ", \"free_bytes\": " << memory.freeBytes << ", \"largest_free_range\": " << memory.largestFreeRange << ", \"fragmentation\": " << memory.fragmentation << "},\n";
+        out << "  \"frame_sync\": \"" << (timelineSemaphoresEnabled ? "timeline_semaphore" : "fences") << "\",\n";
+        out << "  \"warmup_frames\": " << settings.warmupFrames << ",\n";
+        out << "  \"measured_frames\": " << measuredFrames << ",\n";
+        out << "  \"fps\": " << fps << ",\n";
+        out << "  \"cpu_frame_time_ms\": ";
+        cpuFrameTime.writeJson(out);
+        out << ",\n";
+        out << "  \"fence_wait_ms\": ";
+        fenceWait.writeJson(out);
+        out << ",\n";
+        out << "  \"gpu_timestamps_supported\": " << (timestampQueryPool != VK_NULL_HANDLE ? "true" : "false") << ",\n";
+        out << "  \"gpu_frames\": " << frameStats.gpuFrameTimesMs.size() << ",\n";
+        out << "  \"gpu_frame_time_ms\": ";
+        gpuFrameTime.writeJson(out);
+        out << ",\n";
+        // If the GPU takes longer per frame than the CPU does (not counting time the CPU spent waiting on the GPU), the GPU is the bottleneck.
+        const char* bottleneck = "unknown";
+        if (!frameStats.gpuFrameTimesMs.empty()) {
+            bottleneck = gpuFrameTime.mean > (cpuFrameTime.mean - fenceWait.mean) ? "gpu" : "cpu";
+        }
+        out << "  \"bottleneck\": \"" << bottleneck << "\"\n";
+        out << "}\n";
 
-        // Terminate glfw itself
-        glfwTerminate();
+        if (settings.benchmarkOutputPath.empty()) {
+            reportOut << out.str() << std::flush;
+            return;
+        }
+        std::ofstream file(settings.benchmarkOutputPath);
+        if (!file.is_open()) {
+            throw std::runtime_error("ERROR! Failed to open benchmark output file " + settings.benchmarkOutputPath);
+        }
+        file << out.str();
     }
     // ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
 
@@ -273,6 +3445,7 @@ private:
 
     // Fill in a struct with details about the debug messenger and its callback .
     void setupDebugMessenger() {
+        PROFILE_ZONE("setupDebugMessenger");
         if (!enableValidationLayers) return;
 
         // Create struct and populate
@@ -380,9 +3553,14 @@ private:
 
     // The instance is connection b/w your app and the Vulkan library.
     void createInstance() {
+        PROFILE_ZONE("createInstance");
 
         // First, check if the requested validation layers are available.
-        if (enableValidationLayers && !checkValidationLayerSupport()) {
+        bool validationLayersSupported = true;
+        if (enableValidationLayers) {
+            timeStartupPhase("checkValidationLayerSupport", [&]() { validationLayersSupported = checkValidationLayerSupport(); });
+        }
+        if (!validationLayersSupported) {
             throw std::runtime_error("ERROR! Validation layers requested, but not available!");
         }
 
@@ -455,7 +3633,9 @@ private:
         // 1) Pointer to struct with creation info
         // 2) Pointer to custom allocator callbacks, always nullptr for this tutorial
         // 3) Pointer to the variable that store the handle to the new object
-        if (vkCreateInstance(&createInfo, nullptr, &instance) != VK_SUCCESS) {
+        VkResult result;
+        timeStartupPhase("vkCreateInstance", [&]() { result = vkCreateInstance(&createInfo, nullptr, &instance); });
+        if (result != VK_SUCCESS) {
             throw std::runtime_error("failed to create instance!");
         }
 
@@ -465,9 +3645,11 @@ private:
     std::vector<const char*> getAndCheckRequiredExtensions(std::vector<VkExtensionProperties> availableExtensions) {
         // GLFW has built-in func that returns the extensions it needs for Vulkan to interface with the window system.
         uint32_t glfwExtensionCount = 0;
-        const char** glfwExtensions;
-        // Use the built-in func to get # extensions.
-        glfwExtensions = glfwGetRequiredInstanceExtensions(&glfwExtensionCount);
+        const char** glfwExtensions = nullptr;
+        // Use the built-in func to get # extensions. There is no window system to interface with in headless mode (and GLFW isn't initialized), so no extensions are needed for it.
+        if (!settings.headless) {
+            glfwExtensions = glfwGetRequiredInstanceExtensions(&glfwExtensionCount);
+        }
 
         // Print out the glfw extensions
         std::cout << "\nRequired GLFW extensions:\n~~~~~~~~~~~~~~~~~~~~~~~~\n";
@@ -479,12 +3661,23 @@ private:
         checkRequiredExtensionsPresent(availableExtensions, glfwExtensions, glfwExtensionCount);
 
         // Create a char* vector filled with the glfwExtensions array. Start from beginning of glfwExtensions, and go until end of the array.
-        std::vector<const char*> requiredExtensions(glfwExtensions, glfwExtensions + glfwExtensionCount);
+        std::vector<const char*> requiredExtensions;
+        if (glfwExtensionCount > 0) {
+            requiredExtensions.assign(glfwExtensions, glfwExtensions + glfwExtensionCount);
+        }
 
         // To set up a callback in the program to handle messages and associated details, have to setup a debug messenger with a callback using the VK_EXT_debug_utils extension (add using macro below)
         if (enableValidationLayers) {
             requiredExtensions.push_back(VK_EXT_DEBUG_UTILS_EXTENSION_NAME);
         }
+
+        // Optionally enable VK_KHR_get_physical_device_properties2 if it's there. Without it (or Vulkan 1.1), there's no way to ask the device about features that come from extensions, like timeline semaphores.
+        for (const auto& extension : availableExtensions) {
+            if (strcmp(extension.extensionName, VK_KHR_GET_PHYSICAL_DEVICE_PROPERTIES_2_EXTENSION_NAME) == 0) {
+                requiredExtensions.push_back(VK_KHR_GET_PHYSICAL_DEVICE_PROPERTIES_2_EXTENSION_NAME);
+                physicalDeviceProperties2Enabled = true;
+            }
+        }
         return requiredExtensions;
 
     }
@@ -514,6 +3707,7 @@ private:
 
     // Creates a VkSurfaceKHR (based on system details like Windows vs Linux) for Vulkan to interface with the window system
     void createSurface() {
+        PROFILE_ZONE("createSurface");
         // glfwCreateWindow surface takes care of platform specific instantiations of a VkSurfaceKHR surface. For example, on Windows this call will create a VkWin32SurfaceCreateInfoKHR  struct, fill it in with platform specific details, and then call vkCreateWin32SurfaceKHR(). On Linux, different methods will be used.
         if (glfwCreateWindowSurface(instance, window, nullptr, &surface) != VK_SUCCESS) {
             throw std::runtime_error("ERROR! Failed to create window surface!");
@@ -529,6 +3723,7 @@ private:
 
     // Look for and select a GPU in the system that supports the features we need.
     void pickPhysicalDevice() {
+        PROFILE_ZONE("pickPhysicalDevice");
         uint32_t deviceCount = 0;
         // Query the # of devices and then ...
         vkEnumeratePhysicalDevices(instance, &deviceCount, nullptr);
@@ -552,6 +3747,7 @@ private:
         if (physicalDevice == VK_NULL_HANDLE) {
             throw std::runtime_error("ERROR! Failed to find a suitable GPU!");
         }
+        vkGetPhysicalDeviceProperties(physicalDevice, &physicalDeviceProperties);
 
     }
 
@@ -574,9 +3770,9 @@ private:
         // Check if all extensions are supported.
         bool extensionsSupported = checkDeviceExtensionSupport(device);
 
-        // Check if the swap chain is adqeuate by checking if there is atleast one supported image format and atleast one supported presentation mode.
-        bool swapChainAdequate = false;
-        if (extensionsSupported) {
+        // Check if the swap chain is adqeuate by checking if there is atleast one supported image format and atleast one supported presentation mode. There's no swap chain in headless mode, so nothing to check.
+        bool swapChainAdequate = settings.headless;
+        if (extensionsSupported && !settings.headless) {
             // NOTE! This is not creating the swap chain we'll be using, simply is checking if there is a valid swap chain. The swap chain will be created after the logical device is created.
             SwapChainSupportDetails swapChainSupport = querySwapChainSupport(device);
             swapChainAdequate = swapChainSupport.isAdequate();
@@ -607,9 +3803,14 @@ private:
             if (queueFamily.queueFlags & VK_QUEUE_GRAPHICS_BIT) {
                 indices.graphicsFamily = i;
             }
-            // Check for presentation support
+            // Check for presentation support. In headless mode there is no surface to present to, so the presentation queue is just an alias of the graphics queue (and never used).
             VkBool32 presentationSupport = false;
-            vkGetPhysicalDeviceSurfaceSupportKHR(device, i, surface, &presentationSupport);
+            if (settings.headless) {
+                presentationSupport = (queueFamily.queueFlags & VK_QUEUE_GRAPHICS_BIT) != 0;
+            }
+            else {
+                vkGetPhysicalDeviceSurfaceSupportKHR(device, i, surface, &presentationSupport);
+            }
             if (presentationSupport) {
                 indices.presentationFamily = i;
             }
@@ -635,7 +3836,8 @@ private:
         vkEnumerateDeviceExtensionProperties(device, nullptr, &extensionCount, availableExtensions.data());
 
         // Use a set of strings to represent the unconformed required extensions.
-        std::set<std::string> requiredExtensions(deviceExtensions.begin(), deviceExtensions.end());
+        std::vector<const char*> enabledExtensions = getRequiredDeviceExtensions();
+        std::set<std::string> requiredExtensions(enabledExtensions.begin(), enabledExtensions.end());
         // For each avaialable extension, remove from set of unconfirmed required extensions.
         for (const auto& extension : availableExtensions) {
             requiredExtensions.erase(extension.extensionName);
@@ -649,8 +3851,101 @@ private:
         return requiredExtensions.empty();
     }
 
+    // Check if a single (optional) device extension is supported.
+    bool isDeviceExtensionAvailable(VkPhysicalDevice device, const char* extensionName) {
+        uint32_t extensionCount;
+        vkEnumerateDeviceExtensionProperties(device, nullptr, &extensionCount, nullptr);
+        std::vector<VkExtensionProperties> availableExtensions(extensionCount);
+        vkEnumerateDeviceExtensionProperties(device, nullptr, &extensionCount, availableExtensions.data());
+
+        for (const auto& extension : availableExtensions) {
+            if (strcmp(extension.extensionName, extensionName) == 0) {
+                return true;
+            }
+        }
+        return false;
+    }
+
+    // Query the features in the pNext chain of features (VkPhysicalDevice*FeaturesKHR/EXT structs). Needs VK_KHR_get_physical_device_properties2, whose functions have to be looked up like the debug messenger ones.
+    void getPhysicalDeviceFeatures2(VkPhysicalDevice device, void* features) {
+        VkPhysicalDeviceFeatures2KHR deviceFeatures2{};
+        deviceFeatures2.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_FEATURES_2_KHR;
+        deviceFeatures2.pNext = features;
+
+        auto func = (PFN_vkGetPhysicalDeviceFeatures2KHR)vkGetInstanceProcAddr(instance, "vkGetPhysicalDeviceFeatures2KHR");
+        if (func != nullptr) {
+            func(device, &deviceFeatures2);
+        }
+    }
+
+    // Check if the physical device supports VK_KHR_timeline_semaphore, and that the timelineSemaphore feature is actually there.
+    bool isTimelineSemaphoreSupported(VkPhysicalDevice device) {
+        if (!physicalDeviceProperties2Enabled || !isDeviceExtensionAvailable(device, VK_KHR_TIMELINE_SEMAPHORE_EXTENSION_NAME)) {
+            return false;
+        }
+        VkPhysicalDeviceTimelineSemaphoreFeaturesKHR timelineFeatures{};
+        timelineFeatures.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_TIMELINE_SEMAPHORE_FEATURES_KHR;
+        getPhysicalDeviceFeatures2(device, &timelineFeatures);
+        return timelineFeatures.timelineSemaphore == VK_TRUE;
+    }
+
+    // Check if the physical device supports VK_EXT_graphics_pipeline_library (and VK_KHR_pipeline_library, which it builds on), with the graphicsPipelineLibrary feature.
+    bool isPipelineLibrarySupported(VkPhysicalDevice device) {
+        if (!physicalDeviceProperties2Enabled || !isDeviceExtensionAvailable(device, VK_KHR_PIPELINE_LIBRARY_EXTENSION_NAME)
+            || !isDeviceExtensionAvailable(device, VK_EXT_GRAPHICS_PIPELINE_LIBRARY_EXTENSION_NAME)) {
+            return false;
+        }
+        VkPhysicalDeviceGraphicsPipelineLibraryFeaturesEXT libraryFeatures{};
+        libraryFeatures.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_GRAPHICS_PIPELINE_LIBRARY_FEATURES_EXT;
+        getPhysicalDeviceFeatures2(device, &libraryFeatures);
+        return libraryFeatures.graphicsPipelineLibrary == VK_TRUE;
+    }
+
+    /* Check if the physical device supports VK_EXT_shader_object, with the shaderObject feature. It requires
+    VK_KHR_dynamic_rendering (which is only needed to be enabled, the app keeps using its render pass) and, since the app
+    asks for Vulkan 1.0, the extensions dynamic rendering depends on.*/
+    bool isShaderObjectSupported(VkPhysicalDevice device) {
+        if (!physicalDeviceProperties2Enabled || !isDeviceExtensionAvailable(device, VK_EXT_SHADER_OBJECT_EXTENSION_NAME)) {
+            return false;
+        }
+        for (const char* extension : shaderObjectDependencies) {
+            if (!isDeviceExtensionAvailable(device, extension)) {
+                return false;
+            }
+        }
+        VkPhysicalDeviceShaderObjectFeaturesEXT shaderObjectFeatures{};
+        shaderObjectFeatures.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_SHADER_OBJECT_FEATURES_EXT;
+        getPhysicalDeviceFeatures2(device, &shaderObjectFeatures);
+        return shaderObjectFeatures.shaderObject == VK_TRUE;
+    }
+
+    // Whether linking pipeline libraries without link time optimization is guaranteed to be fast on this device.
+    bool isPipelineLibraryFastLinkingSupported(VkPhysicalDevice device) {
+        VkPhysicalDeviceGraphicsPipelineLibraryPropertiesEXT libraryProperties{};
+        libraryProperties.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_GRAPHICS_PIPELINE_LIBRARY_PROPERTIES_EXT;
+        VkPhysicalDeviceProperties2KHR properties2{};
+        properties2.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_PROPERTIES_2_KHR;
+        properties2.pNext = &libraryProperties;
+
+        auto func = (PFN_vkGetPhysicalDeviceProperties2KHR)vkGetInstanceProcAddr(instance, "vkGetPhysicalDeviceProperties2KHR");
+        if (func == nullptr) {
+            return false;
+        }
+        func(device, &properties2);
+        return libraryProperties.graphicsPipelineLibraryFastLinking == VK_TRUE;
+    }
+
+    // Returns the device extensions that need to be enabled. Headless mode never creates a swap chain, so doesn't need the swap chain extension.
+    std::vector<const char*> getRequiredDeviceExtensions() {
+        if (settings.headless) {
+            return {};
+        }
+        return deviceExtensions;
+    }
+
     // Create a logical device to interface with the chosen physical device.
     void createLogicalDevice() {
+        PROFILE_ZONE("createLogicalDevice");
         // Get the indices of queue families for the physical device
         QueueFamilyIndices indices = findQueueFamilies(physicalDevice);
 
@@ -684,8 +3979,67 @@ private:
         createInfo.pEnabledFeatures = &deviceFeatures;
 
         // Pass in the device extension count and names
-        createInfo.enabledExtensionCount = static_cast<uint32_t>(deviceExtensions.size());
-        createInfo.ppEnabledExtensionNames = deviceExtensions.data();
+        std::vector<const char*> enabledExtensions = getRequiredDeviceExtensions();
+
+        // Optional extensions are added on top of the required ones when they are asked for and supported. Features that come from extensions have to be turned on by chaining their feature structs onto pNext.
+        void* featureChain = nullptr;
+        VkPhysicalDeviceTimelineSemaphoreFeaturesKHR timelineFeatures{};
+        if (settings.timelineSemaphores) {
+            if (isTimelineSemaphoreSupported(physicalDevice)) {
+                enabledExtensions.push_back(VK_KHR_TIMELINE_SEMAPHORE_EXTENSION_NAME);
+                timelineFeatures.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_TIMELINE_SEMAPHORE_FEATURES_KHR;
+                timelineFeatures.timelineSemaphore = VK_TRUE;
+                timelineFeatures.pNext = featureChain;
+                featureChain = &timelineFeatures;
+                timelineSemaphoresEnabled = true;
+            }
+            else {
+                std::cout << "WARNING! Timeline semaphores aren't supported by this device, using fences for frame pacing.\n";
+            }
+        }
+        VkPhysicalDeviceGraphicsPipelineLibraryFeaturesEXT libraryFeatures{};
+        if (settings.pipelineLibraries) {
+            if (isPipelineLibrarySupported(physicalDevice)) {
+                enabledExtensions.push_back(VK_KHR_PIPELINE_LIBRARY_EXTENSION_NAME);
+                enabledExtensions.push_back(VK_EXT_GRAPHICS_PIPELINE_LIBRARY_EXTENSION_NAME);
+                libraryFeatures.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_GRAPHICS_PIPELINE_LIBRARY_FEATURES_EXT;
+                libraryFeatures.graphicsPipelineLibrary = VK_TRUE;
+                libraryFeatures.pNext = featureChain;
+                featureChain = &libraryFeatures;
+                pipelineLibrariesEnabled = true;
+                pipelineLibraryFastLinking = isPipelineLibraryFastLinkingSupported(physicalDevice);
+                if (!pipelineLibraryFastLinking) {
+                    std::cout << "WARNING! This device doesn't guarantee fast linking of pipeline libraries, so pipelines are link time optimized right away.\n";
+                }
+            }
+            else {
+                std::cout << "WARNING! Graphics pipeline libraries aren't supported by this device, creating whole pipelines.\n";
+            }
+        }
+        // Creation feedback has no feature to turn on and costs nothing, so it's always enabled when it's there. It's how we know the pipeline cache actually gets hit.
+        if (isDeviceExtensionAvailable(physicalDevice, VK_EXT_PIPELINE_CREATION_FEEDBACK_EXTENSION_NAME)) {
+            enabledExtensions.push_back(VK_EXT_PIPELINE_CREATION_FEEDBACK_EXTENSION_NAME);
+            pipelineCreationFeedbackEnabled = true;
+        }
+        VkPhysicalDeviceShaderObjectFeaturesEXT shaderObjectFeatures{};
+        if (settings.shaderObjects) {
+            if (isShaderObjectSupported(physicalDevice)) {
+                enabledExtensions.push_back(VK_EXT_SHADER_OBJECT_EXTENSION_NAME);
+                enabledExtensions.insert(enabledExtensions.end(), shaderObjectDependencies.begin(), shaderObjectDependencies.end());
+                shaderObjectFeatures.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_SHADER_OBJECT_FEATURES_EXT;
+                shaderObjectFeatures.shaderObject = VK_TRUE;
+                shaderObjectFeatures.pNext = featureChain;
+                featureChain = &shaderObjectFeatures;
+                shaderObjectsEnabled = true;
+            }
+            else {
+                std::cout << "WARNING! Shader objects aren't supported by this device, drawing with pipelines.\n";
+            }
+        }
+        createInfo.pNext = featureChain;
+
+        createInfo.enabledExtensionCount = static_cast<uint32_t>(enabledExtensions.size());
+        createInfo.ppEnabledExtensionNames = enabledExtensions.data();
 
         // New versions of Vulkan ignore distinctions b/w instance and device specific validation layers. Specifying here to be compatible with older implementations.
         if (enableValidationLayers) {
@@ -705,6 +4059,51 @@ private:
         vkGetDeviceQueue(device, indices.graphicsFamily.value(), 0, &graphicsQueue);
         vkGetDeviceQueue(device, indices.presentationFamily.value(), 0, &presentationQueue);
 
+        // Extension functions aren't exported by the loader, so look them up from the device.
+        if (timelineSemaphoresEnabled) {
+            waitSemaphoresKHR = (PFN_vkWaitSemaphoresKHR)vkGetDeviceProcAddr(device, "vkWaitSemaphoresKHR");
+            getSemaphoreCounterValueKHR = (PFN_vkGetSemaphoreCounterValueKHR)vkGetDeviceProcAddr(device, "vkGetSemaphoreCounterValueKHR");
+            if (waitSemaphoresKHR == nullptr || getSemaphoreCounterValueKHR == nullptr) {
+                throw std::runtime_error("ERROR! Failed to load VK_KHR_timeline_semaphore functions!");
+            }
+        }
+        if (shaderObjectsEnabled) {
+            loadShaderObjectFunctions();
+        }
+
+    }
+
+    // Look up the VK_EXT_shader_object functions. They all come with the extension, so a missing one means a broken driver.
+    void loadShaderObjectFunctions() {
+        auto load = [this](auto& function, const char* name) {
+            function = reinterpret_cast<std::remove_reference_t<decltype(function)>>(vkGetDeviceProcAddr(device, name));
+            if (function == nullptr) {
+                throw std::runtime_error(std::string("ERROR! Failed to load ") + name + "!");
+            }
+        };
+        ShaderObjectFunctions& f = shaderObjectFunctions;
+        load(f.createShaders, "vkCreateShadersEXT");
+        load(f.destroyShader, "vkDestroyShaderEXT");
+        load(f.cmdBindShaders, "vkCmdBindShadersEXT");
+        load(f.cmdSetViewportWithCount, "vkCmdSetViewportWithCountEXT");
+        load(f.cmdSetScissorWithCount, "vkCmdSetScissorWithCountEXT");
+        load(f.cmdSetRasterizerDiscardEnable, "vkCmdSetRasterizerDiscardEnableEXT");
+        load(f.cmdSetPolygonMode, "vkCmdSetPolygonModeEXT");
+        load(f.cmdSetRasterizationSamples, "vkCmdSetRasterizationSamplesEXT");
+        load(f.cmdSetSampleMask, "vkCmdSetSampleMaskEXT");
+        load(f.cmdSetAlphaToCoverageEnable, "vkCmdSetAlphaToCoverageEnableEXT");
+        load(f.cmdSetCullMode, "vkCmdSetCullModeEXT");
+        load(f.cmdSetFrontFace, "vkCmdSetFrontFaceEXT");
+        load(f.cmdSetDepthTestEnable, "vkCmdSetDepthTestEnableEXT");
+        load(f.cmdSetDepthWriteEnable, "vkCmdSetDepthWriteEnableEXT");
+        load(f.cmdSetDepthBiasEnable, "vkCmdSetDepthBiasEnableEXT");
+        load(f.cmdSetStencilTestEnable, "vkCmdSetStencilTestEnableEXT");
+        load(f.cmdSetPrimitiveTopology, "vkCmdSetPrimitiveTopologyEXT");
+        load(f.cmdSetPrimitiveRestartEnable, "vkCmdSetPrimitiveRestartEnableEXT");
+        load(f.cmdSetVertexInput, "vkCmdSetVertexInputEXT");
+        load(f.cmdSetColorBlendEnable, "vkCmdSetColorBlendEnableEXT");
+        load(f.cmdSetColorBlendEquation, "vkCmdSetColorBlendEquationEXT");
+        load(f.cmdSetColorWriteMask, "vkCmdSetColorWriteMaskEXT");
     }
     // ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
 
@@ -812,7 +4211,8 @@ private:
     }
 
     // Next, create the swap chain for rendered images to be sent to and for presenting images to the window system using all the best settings found above.
-    void createSwapChain() {
+    void createSwapChain(VkSwapchainKHR oldSwapChain = VK_NULL_HANDLE) {
+        PROFILE_ZONE("createSwapChain");
         // Fill in the swap chain struct with capabilities, surface formats, and presentation modes.
         SwapChainSupportDetails swapChainSupport = querySwapChainSupport(physicalDevice);
 
@@ -873,8 +4273,9 @@ private:
         // If true, means we don't care about color of pixels that are obscured. Offers best results.
         createInfo.clipped = VK_TRUE;
 
-        // With Vulkan, it's possible your swap chain becomes invalid or unoptimized while app is still running for example if window is resized. In this case, the swap chain needs to be recreated from scratch and a reference to an old one needs to be specified. Ignore for now.
-        createInfo.oldSwapchain = VK_NULL_HANDLE;
+        // With Vulkan, it's possible your swap chain becomes invalid or unoptimized while app is still running for example if window is resized. In this case, the swap chain needs to be recreated from scratch and a reference to an old one needs to be specified.
+        // Handing over the old swap chain lets the driver reuse its resources, and lets images that were already presented from it finish presenting while we move on to the new one. The old swap chain can't be acquired from anymore after this, but still has to be destroyed (see recreateSwapChain()).
+        createInfo.oldSwapchain = oldSwapChain;
 
         // FINALLY, create the swap chain by providing the device, the creation info, optional custom allocators, and pointer to store the handle in.
         if (vkCreateSwapchainKHR(device, &createInfo, nullptr, &swapChain) != VK_SUCCESS) {
@@ -894,9 +4295,258 @@ private:
         swapChainExtent = extent;
     }
 
+    // Headless stand-in for createSwapChain(). Creates device-local VkImages to render into, and stores them in swapChainImages so that the image views, render pass, pipeline, framebuffers and command buffers are all created exactly like they are for the window.
+    void createOffscreenTargets() {
+        PROFILE_ZONE("createOffscreenTargets");
+        swapChainImageFormat = HEADLESS_IMAGE_FORMAT;
+        swapChainExtent = { WIDTH, HEIGHT };
+        std::cout << "\nOffscreen Format: " << swapChainImageFormat << "\n";
+        std::cout << "Offscreen Extent Width: " << swapChainExtent.width << ", Offscreen Extent Height: " << swapChainExtent.height << "\n\n";
+
+        swapChainImages.resize(HEADLESS_IMAGE_COUNT);
+        offscreenImageMemory.resize(HEADLESS_IMAGE_COUNT);
+
+        for (size_t i = 0; i < swapChainImages.size(); i++) {
+            VkImageCreateInfo imageInfo{};
+            imageInfo.sType = VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO;
+            imageInfo.imageType = VK_IMAGE_TYPE_2D;
+            imageInfo.format = swapChainImageFormat;
+            imageInfo.extent = { swapChainExtent.width, swapChainExtent.height, 1 };
+            imageInfo.mipLevels = 1;
+            imageInfo.arrayLayers = 1;
+            imageInfo.samples = VK_SAMPLE_COUNT_1_BIT;
+            // Optimal tiling lets the driver lay the image out however is fastest for rendering. We never map these images.
+            imageInfo.tiling = VK_IMAGE_TILING_OPTIMAL;
+            // Rendered to as a color attachment, and can be copied out of if the results need to be read back.
+            imageInfo.usage = VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT | VK_IMAGE_USAGE_TRANSFER_SRC_BIT;
+            // Only the graphics queue ever touches these images.
+            imageInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+            imageInfo.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+
+            if (vkCreateImage(device, &imageInfo, nullptr, &swapChainImages[i]) != VK_SUCCESS) {
+                throw std::runtime_error("ERROR! Failed to create offscreen image!");
+            }
+
+            // Unlike swap chain images, we have to allocate and bind the memory backing the image ourselves. Optimal tiling, so not linear.
+            VkMemoryRequirements memRequirements;
+            vkGetImageMemoryRequirements(device, swapChainImages[i], &memRequirements);
+            // On failure, release this image's resources and clear its slot, so destroyOffscreenTargets() can still clean up the earlier ones.
+            try {
+                offscreenImageMemory[i] = memoryAllocator.allocate(memRequirements, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, false);
+            }
+            catch (const std::exception&) {
+                vkDestroyImage(device, swapChainImages[i], nullptr);
+                swapChainImages[i] = VK_NULL_HANDLE;
+                throw;
+            }
+            if (vkBindImageMemory(device, swapChainImages[i], offscreenImageMemory[i].memory, offscreenImageMemory[i].offset) != VK_SUCCESS) {
+                vkDestroyImage(device, swapChainImages[i], nullptr);
+                swapChainImages[i] = VK_NULL_HANDLE;
+                memoryAllocator.free(offscreenImageMemory[i]);
+                offscreenImageMemory[i] = {};
+                throw std::runtime_error("ERROR! Failed to bind offscreen image memory!");
+            }
+        }
+        std::cout << "Number of offscreen images: " << swapChainImages.size() << "\n";
+    }
+
+    // Destroy the offscreen images created in createOffscreenTargets() and free their memory.
+    void destroyOffscreenTargets() {
+        for (size_t i = 0; i < swapChainImages.size(); i++) {
+            vkDestroyImage(device, swapChainImages[i], nullptr);
+            memoryAllocator.free(offscreenImageMemory[i]);
+        }
+        swapChainImages.clear();
+        offscreenImageMemory.clear();
+    }
+
+    /* The window surface changed (resized, or the driver told us the swap chain is out of date), so everything that
+    depends on the swap chain has to be created again: the swap chain itself, its image views and the framebuffers.
+    The pipeline is kept, since its viewport and scissor are dynamic state. Command buffers are recorded every frame, so
+    they pick up the new objects and extent on their own.
+    The render pass only depends on the image format, which doesn't change for the same surface, so it is kept.
+
+    Frames that were already submitted may still be using the old objects, so instead of waiting for the whole device
+    to go idle, the old objects are handed to deferDestroy() and destroyed once those frames are done. The old swap
+    chain is passed as oldSwapchain, so presentation keeps flowing while the new one is set up.*/
+    void recreateSwapChain() {
+        PROFILE_ZONE("recreateSwapChain");
+        // A minimized window has a framebuffer size of 0, and a swap chain can't be created with that. Wait until it's visible again.
+        int width = 0, height = 0;
+        glfwGetFramebufferSize(window, &width, &height);
+        while ((width == 0 || height == 0) && !glfwWindowShouldClose(window)) {
+            glfwWaitEvents();
+            glfwGetFramebufferSize(window, &width, &height);
+        }
+        // Closed while minimized, so there's nothing left to recreate for. mainLoop() exits on the next frame.
+        if (width == 0 || height == 0) {
+            return;
+        }
+        framebufferResized = false;
+
+        // Hand everything that's being replaced over to deferred deletion. The lambdas copy the handles, so the members can be overwritten right away.
+        VkSwapchainKHR oldSwapChain = swapChain;
+        std::vector<VkImageView> oldImageViews = swapChainImageViews;
+        std::vector<VkFramebuffer> oldFramebuffers = swapChainFramebuffers;
+        deferDestroy([this, oldSwapChain, oldImageViews, oldFramebuffers]() {
+            for (auto framebuffer : oldFramebuffers) {
+                vkDestroyFramebuffer(device, framebuffer, nullptr);
+            }
+            for (auto imageView : oldImageViews) {
+                vkDestroyImageView(device, imageView, nullptr);
+            }
+            vkDestroySwapchainKHR(device, oldSwapChain, nullptr);
+        });
+
+        createSwapChain(oldSwapChain);
+        createImageViews();
+        createFramebuffers();
+
+        // None of the new images are in use yet. Frames still in flight on old images are covered by the per-frame fences/timeline values.
+        if (timelineSemaphoresEnabled) {
+            imageTimelineValues.assign(swapChainImages.size(), 0);
+        }
+        else {
+            imagesInFlight.assign(swapChainImages.size(), VK_NULL_HANDLE);
+        }
+        std::cout << "\n{########## Swap chain recreated. ##########}\n";
+    }
+
+    // Create a buffer and allocate and bind memory with the given properties for it.
+    void createBuffer(VkDeviceSize size, VkBufferUsageFlags usage, VkMemoryPropertyFlags properties, VkBuffer& buffer, DeviceMemoryAllocator::Allocation& bufferMemory) {
+        VkBufferCreateInfo bufferInfo{};
+        bufferInfo.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
+        bufferInfo.size = size;
+        bufferInfo.usage = usage;
+        // Only the graphics queue uses the buffers (transfers are done on it too).
+        bufferInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+        if (vkCreateBuffer(device, &bufferInfo, nullptr, &buffer) != VK_SUCCESS) {
+            throw std::runtime_error("ERROR! Failed to create buffer!");
+        }
+
+        // Buffers are always linear. Host visible memory comes back already mapped.
+        VkMemoryRequirements memRequirements;
+        vkGetBufferMemoryRequirements(device, buffer, &memRequirements);
+        try {
+            bufferMemory = memoryAllocator.allocate(memRequirements, properties, true);
+        }
+        catch (const std::exception&) {
+            vkDestroyBuffer(device, buffer, nullptr);
+            throw;
+        }
+        if (vkBindBufferMemory(device, buffer, bufferMemory.memory, bufferMemory.offset) != VK_SUCCESS) {
+            vkDestroyBuffer(device, buffer, nullptr);
+            memoryAllocator.free(bufferMemory);
+            throw std::runtime_error("ERROR! Failed to bind buffer memory!");
+        }
+    }
+
+    /* Create the vertex and index buffers. Memory the CPU can write to is usually not the fastest for the GPU to read
+    from, so the data is written into a host visible staging buffer first, and then copied into DEVICE_LOCAL buffers on
+    the GPU with a transfer command. The staging buffer is only needed until the copy is done.*/
+    void createVertexBuffers() {
+        PROFILE_ZONE("createVertexBuffers");
+        VkDeviceSize vertexBufferSize = sizeof(vertices[0]) * vertices.size();
+        VkDeviceSize indexBufferSize = sizeof(indices[0]) * indices.size();
+
+        // One staging buffer holds both, vertices first. Coherent memory means the writes don't need to be flushed. The allocator keeps it mapped.
+        VkBuffer stagingBuffer;
+        DeviceMemoryAllocator::Allocation stagingBufferMemory;
+        createBuffer(vertexBufferSize + indexBufferSize, VK_BUFFER_USAGE_TRANSFER_SRC_BIT, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, stagingBuffer, stagingBufferMemory);
+        char* data = static_cast<char*>(stagingBufferMemory.mapped);
+        std::memcpy(data, vertices.data(), static_cast<size_t>(vertexBufferSize));
+        std::memcpy(data + vertexBufferSize, indices.data(), static_cast<size_t>(indexBufferSize));
+
+        // The staging buffer is released whether or not the upload works.
+        try {
+            createBuffer(vertexBufferSize, VK_BUFFER_USAGE_TRANSFER_DST_BIT | VK_BUFFER_USAGE_VERTEX_BUFFER_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, vertexBuffer, vertexBufferMemory);
+            createBuffer(indexBufferSize, VK_BUFFER_USAGE_TRANSFER_DST_BIT | VK_BUFFER_USAGE_INDEX_BUFFER_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, indexBuffer, indexBufferMemory);
+
+            // Record both copies into one command buffer and wait for it.
+            submitOneTimeCommands([&](VkCommandBuffer commandBuffer) {
+                VkBufferCopy vertexCopy{};
+                vertexCopy.srcOffset = 0;
+                vertexCopy.size = vertexBufferSize;
+                vkCmdCopyBuffer(commandBuffer, stagingBuffer, vertexBuffer, 1, &vertexCopy);
+                VkBufferCopy indexCopy{};
+                indexCopy.srcOffset = vertexBufferSize;
+                indexCopy.size = indexBufferSize;
+                vkCmdCopyBuffer(commandBuffer, stagingBuffer, indexBuffer, 1, &indexCopy);
+
+                // Make the copied data visible to the vertex input stage of the frames submitted after this.
+                VkMemoryBarrier barrier{};
+                barrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+                barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+                barrier.dstAccessMask = VK_ACCESS_VERTEX_ATTRIBUTE_READ_BIT | VK_ACCESS_INDEX_READ_BIT;
+                vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_VERTEX_INPUT_BIT, 0, 1, &barrier, 0, nullptr, 0, nullptr);
+            });
+        }
+        catch (const std::exception&) {
+            vkDestroyBuffer(device, stagingBuffer, nullptr);
+            memoryAllocator.free(stagingBufferMemory);
+            throw;
+        }
+
+        vkDestroyBuffer(device, stagingBuffer, nullptr);
+        memoryAllocator.free(stagingBufferMemory);
+        std::cout << "Uploaded " << vertices.size() << " vertices and " << indices.size() << " indices.\n";
+    }
+
+    /* Record commands with record into a command buffer, submit it to the graphics queue and wait until it's done. For
+    work that's done once, like uploads, so it uses its own short-lived command pool rather than a frame's.*/
+    template <typename Record>
+    void submitOneTimeCommands(Record&& record) {
+        QueueFamilyIndices queueFamilyIndices = findQueueFamilies(physicalDevice);
+        VkCommandPoolCreateInfo poolInfo{};
+        poolInfo.sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO;
+        poolInfo.queueFamilyIndex = queueFamilyIndices.graphicsFamily.value();
+        poolInfo.flags = VK_COMMAND_POOL_CREATE_TRANSIENT_BIT;
+        VkCommandPool pool;
+        if (vkCreateCommandPool(device, &poolInfo, nullptr, &pool) != VK_SUCCESS) {
+            throw std::runtime_error("ERROR! Failed to create command pool!");
+        }
+
+        VkCommandBufferAllocateInfo allocInfo{};
+        allocInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
+        allocInfo.commandPool = pool;
+        allocInfo.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
+        allocInfo.commandBufferCount = 1;
+        VkCommandBuffer commandBuffer;
+        VkResult result = vkAllocateCommandBuffers(device, &allocInfo, &commandBuffer);
+        if (result == VK_SUCCESS) {
+            VkCommandBufferBeginInfo beginInfo{};
+            beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+            beginInfo.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+            vkBeginCommandBuffer(commandBuffer, &beginInfo);
+            try {
+                record(commandBuffer);
+            }
+            catch (const std::exception&) {
+                vkDestroyCommandPool(device, pool, nullptr);
+                throw;
+            }
+            vkEndCommandBuffer(commandBuffer);
+
+            VkSubmitInfo submitInfo{};
+            submitInfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
+            submitInfo.commandBufferCount = 1;
+            submitInfo.pCommandBuffers = &commandBuffer;
+            result = vkQueueSubmit(graphicsQueue, 1, &submitInfo, VK_NULL_HANDLE);
+            if (result == VK_SUCCESS) {
+                result = vkQueueWaitIdle(graphicsQueue);
+            }
+        }
+        // Destroying the pool frees the command buffer too.
+        vkDestroyCommandPool(device, pool, nullptr);
+        if (result != VK_SUCCESS) {
+            throw std::runtime_error("ERROR! Failed to submit one time commands!");
+        }
+    }
+
 
     // Finally, create VkImageViews for interfacing with the VkImage objs within the swap chain
     void createImageViews() {
+        PROFILE_ZONE("createImageViews");
         // Resize to the # of swap chain VkImage objects
         swapChainImageViews.resize(swapChainImages.size());
 
@@ -938,6 +4588,7 @@ private:
     how many color & depth buffers there will be, how many samples to use for each of them, and how
     their contents should be handled throughout the rendering operations.*/
     void createRenderPass() {
+        PROFILE_ZONE("createRenderPass");
         // For this tutorial, just need a single color buffer attachment represented by one of the images from the swap chain.
         VkAttachmentDescription colorAttachment{};
         // Format should match format of swap chain images. Samples is for multisampling.
@@ -959,6 +4610,10 @@ private:
         final layout specifies we want the image to be presented in the swap chain after the render pass.*/
         colorAttachment.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
         colorAttachment.finalLayout = VK_IMAGE_LAYOUT_PRESENT_SRC_KHR;
+        // Offscreen images are never presented, so leave them ready to be copied out of instead.
+        if (settings.headless) {
+            colorAttachment.finalLayout = VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL;
+        }
 
         /*A single render pass can consist of multiple subpasses, which are subsequent rendering
         operations that depend on the contents of framebuffers in previous passes. Can be used to apply
@@ -1034,23 +4689,98 @@ private:
         // Go back to beginning of file and read all of the bytes at once.
         file.seekg(0);
         file.read(buffer.data(), fileSize);
+        if (!file) {
+            throw std::runtime_error("ERROR! Failed to read " + filename + "!");
+        }
+
+        /* Check it's actually SPIR-V before handing it to vkCreateShaderModule, which doesn't have to validate anything.
+        When hot reloading, the file may also still be half written. SPIR-V is a stream of 32-bit words starting with a magic number.*/
+        const uint32_t SPIRV_MAGIC = 0x07230203;
+        uint32_t magic = 0;
+        if (fileSize < sizeof(magic) || fileSize % sizeof(uint32_t) != 0) {
+            throw std::runtime_error("ERROR! " + filename + " is not valid SPIR-V (size is not a multiple of 4 bytes)!");
+        }
+        std::memcpy(&magic, buffer.data(), sizeof(magic));
+        if (magic != SPIRV_MAGIC) {
+            throw std::runtime_error("ERROR! " + filename + " is not valid SPIR-V (bad magic number)!");
+        }
 
         // Close the file and return the buffer.
         file.close();
         return buffer;
     }
 
-    /* Take a buffer with the bytecode and create a shader module. They are just a thin
-     wrapper around shader bytecode.*/
-    VkShaderModule createShaderModule(const std::vector<char>& code) {
-        // Creating a shader module requires only the bytecode and the length of it.
-        VkShaderModuleCreateInfo createInfo{};
-        createInfo.sType = VK_STRUCTURE_TYPE_SHADER_MODULE_CREATE_INFO;
-        createInfo.codeSize = code.size();
+    // The SPIR-V of one shader. Embedded and shader pack SPIR-V is used where it is, SPIR-V that had to be read or compiled is kept in storage.
+    struct ShaderCode {
+        std::vector<char> storage;
+        const uint32_t* code = nullptr;
+        // In bytes.
+        size_t codeSize = 0;
+
+        // code may point into storage, which stays put when a vector is moved but not when it's copied, so only allow moves.
+        ShaderCode() = default;
+        ShaderCode(ShaderCode&&) = default;
+        ShaderCode& operator=(ShaderCode&&) = default;
+    };
+
+    /* Get a shader's SPIR-V from wherever this run gets shaders from, in order of preference:
+        1) compiled from the GLSL source (--compile-shaders),
+        2) the shader pack (--shader-pack),
+        3) the SPIR-V embedded in the executable (built with EMBEDDED_SPIRV), or the .spv files.*/
+    ShaderCode loadShaderCode(const ShaderSource& shader) {
+        ShaderCode shaderCode;
+#ifdef ENABLE_SHADERC
+        if (settings.compileShaders) {
+            if (!shaderCompiler) {
+                shaderCompiler = std::make_unique<ShaderCompiler>();
+            }
+            bool cacheHit = false;
+            shaderCode.storage = shaderCompiler->compile(std::string("shaders/") + shader.name, shader.stage, settings.shaderDefines, settings.shaderCacheDir, cacheHit);
+            std::cout << "\n" << shader.name << (cacheHit ? " loaded from the shader cache.\n" : " compiled.\n");
+            return useStorage(std::move(shaderCode));
+        }
+#endif
+        if (shaderPack.isOpen()) {
+            ShaderPack::Shader packedShader = shaderPack.getShader(shader.name, shader.stage);
+            shaderCode.code = packedShader.code;
+            shaderCode.codeSize = packedShader.codeSize;
+            return shaderCode;
+        }
+#ifdef EMBEDDED_SPIRV
+        // The bytecode is already in the executable.
+        if (shader.stage == VK_SHADER_STAGE_VERTEX_BIT) {
+            shaderCode.code = EMBEDDED_VERT_SPIRV;
+            shaderCode.codeSize = sizeof(EMBEDDED_VERT_SPIRV);
+        }
+        else {
+            shaderCode.code = EMBEDDED_FRAG_SPIRV;
+            shaderCode.codeSize = sizeof(EMBEDDED_FRAG_SPIRV);
+        }
+        return shaderCode;
+#else
+        shaderCode.storage = readShaderFile(shader.spvPath);
+        return useStorage(std::move(shaderCode));
+#endif
+    }
+
+    // Point a ShaderCode at the SPIR-V in its own storage.
+    static ShaderCode useStorage(ShaderCode shaderCode) {
         /* The bytecode size is in bytes, but the bytecode ptr is uint32_t intead of
         a char pointer, so have to cast the ptr to uint32_t. Also need to ensure the data satisfies the data
         alignment requirements. The data stored in std::vector already ensures this.*/
-        createInfo.pCode = reinterpret_cast<const uint32_t*>(code.data());
+        shaderCode.code = reinterpret_cast<const uint32_t*>(shaderCode.storage.data());
+        shaderCode.codeSize = shaderCode.storage.size();
+        return shaderCode;
+    }
+
+    /* Take the bytecode and create a shader module. They are just a thin
+     wrapper around shader bytecode. codeSize is in bytes.*/
+    VkShaderModule createShaderModule(const uint32_t* code, size_t codeSize) {
+        // Creating a shader module requires only the bytecode and the length of it.
+        VkShaderModuleCreateInfo createInfo{};
+        createInfo.sType = VK_STRUCTURE_TYPE_SHADER_MODULE_CREATE_INFO;
+        createInfo.codeSize = codeSize;
+        createInfo.pCode = code;
 
         VkShaderModule shaderModule;
         if (vkCreateShaderModule(device, &createInfo, nullptr, &shaderModule) != VK_SUCCESS) {
@@ -1065,17 +4795,299 @@ private:
     // ~~~~~~~~~~~~~~~~~~~~~~~~ Graphics Pipeline ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
     // ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
 
+    /* The pipeline cache file starts with a header written by the driver (VkPipelineCacheHeaderVersionOne). A cache is only
+    usable by the same driver on the same device, so check the header against the physical device before handing the
+    data to Vulkan. Returns an empty string if the header is valid, otherwise the reason it isn't.*/
+    std::string validatePipelineCacheHeader(const std::vector<char>& data) {
+        // headerSize, headerVersion, vendorID, deviceID (4 bytes each), then the 16 byte pipelineCacheUUID.
+        const size_t headerSize = 4 * sizeof(uint32_t) + VK_UUID_SIZE;
+        if (data.size() < headerSize) {
+            return "file is too small";
+        }
+
+        uint32_t header[4];
+        std::memcpy(header, data.data(), sizeof(header));
+        if (header[0] < headerSize || header[0] > data.size()) {
+            return "bad header size";
+        }
+        if (header[1] != VK_PIPELINE_CACHE_HEADER_VERSION_ONE) {
+            return "unknown header version";
+        }
+        if (header[2] != physicalDeviceProperties.vendorID || header[3] != physicalDeviceProperties.deviceID) {
+            return "written by a different device";
+        }
+        if (std::memcmp(data.data() + sizeof(header), physicalDeviceProperties.pipelineCacheUUID, VK_UUID_SIZE) != 0) {
+            return "written by a different driver version";
+        }
+        return "";
+    }
+
+    // Create the pipeline cache, seeded with the data saved by the last run if there is any and it matches this device & driver.
+    void createPipelineCache() {
+        PROFILE_ZONE("createPipelineCache");
+        std::vector<char> initialData;
+        if (!settings.pipelineCachePath.empty()) {
+            std::ifstream file(settings.pipelineCachePath, std::ios::ate | std::ios::binary);
+            if (file.is_open()) {
+                initialData.resize(static_cast<size_t>(file.tellg()));
+                file.seekg(0);
+                file.read(initialData.data(), initialData.size());
+
+                // A stale, corrupt or unreadable cache isn't an error. Just throw it out and start with an empty cache.
+                std::string problem = !file || static_cast<size_t>(file.gcount()) != initialData.size()
+                    ? "failed to read the file" : validatePipelineCacheHeader(initialData);
+                if (problem.empty()) {
+                    std::cout << "Loaded " << initialData.size() << " bytes of pipeline cache from " << settings.pipelineCachePath << "\n";
+                }
+                else {
+                    std::cout << "Discarding pipeline cache " << settings.pipelineCachePath << " (" << problem << ")\n";
+                    initialData.clear();
+                }
+            }
+        }
+
+        VkPipelineCacheCreateInfo cacheInfo{};
+        cacheInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_CACHE_CREATE_INFO;
+        cacheInfo.initialDataSize = initialData.size();
+        cacheInfo.pInitialData = initialData.empty() ? nullptr : initialData.data();
+
+        if (vkCreatePipelineCache(device, &cacheInfo, nullptr, &pipelineCache) != VK_SUCCESS) {
+            throw std::runtime_error("ERROR! Failed to create pipeline cache!");
+        }
+    }
+
+    /* Write the contents of the pipeline cache to disk. The data is written to a temporary file first, synced to disk, and
+    then renamed over the real one, so a crash (or another process starting up) never sees a half written cache. Failing to save the cache
+    only costs the next run some compile time, so this warns instead of throwing.*/
+    void savePipelineCache() {
+        PROFILE_ZONE("savePipelineCache");
+        if (settings.pipelineCachePath.empty()) {
+            return;
+        }
+
+        // Same two-call pattern as the enumerate functions, first get the size and then the data.
+        size_t dataSize = 0;
+        vkGetPipelineCacheData(device, pipelineCache, &dataSize, nullptr);
+        std::vector<char> data(dataSize);
+        if (dataSize == 0 || vkGetPipelineCacheData(device, pipelineCache, &dataSize, data.data()) != VK_SUCCESS) {
+            std::cerr << "WARNING! Failed to get pipeline cache data, not saving it.\n";
+            return;
+        }
+
+        const std::string tempPath = settings.pipelineCachePath + ".tmp";
+        {
+            std::ofstream file(tempPath, std::ios::binary | std::ios::trunc);
+            file.write(data.data(), dataSize);
+            file.flush();
+            file.close();
+            // The data has to be on disk before the rename, or a crash could replace the old cache with an empty file.
+            if (!file || !syncFileToDisk(tempPath)) {
+                std::cerr << "WARNING! Failed to write pipeline cache to " << tempPath << "\n";
+                std::error_code error;
+                std::filesystem::remove(tempPath, error);
+                return;
+            }
+        }
+
+        std::error_code error;
+        std::filesystem::rename(tempPath, settings.pipelineCachePath, error);
+        if (error) {
+            std::cerr << "WARNING! Failed to replace " << settings.pipelineCachePath << ": " << error.message() << "\n";
+            std::filesystem::remove(tempPath, error);
+            return;
+        }
+        std::cout << "Saved " << dataSize << " bytes of pipeline cache to " << settings.pipelineCachePath << "\n";
+    }
+
     // Create the pipeline for input data to go into, get processed, and drawn to the window system.
     void createGraphicsPipeline() {
-        // ####### Vertex & fragment shader #########
-        // Read in the vertex and fragment shader bytecode. 
-        auto vertShaderCode = readShaderFile("shaders/vert.spv");
-        auto fragShaderCode = readShaderFile("shaders/frag.spv");
+        PROFILE_ZONE("createGraphicsPipeline");
+        // Get the vertex and fragment shader bytecode.
+        ShaderCode vertShaderCode, fragShaderCode;
+        timeStartupPhase("loadShaders", [&]() {
+            vertShaderCode = loadShaderCode(VERTEX_SHADER);
+            fragShaderCode = loadShaderCode(FRAGMENT_SHADER);
+        });
+
+        graphicsPipelineDescription = describeGraphicsPipeline(vertShaderCode, fragShaderCode);
+        // With shader objects there's no pipeline to compile. The shaders are bound on their own, and the description's state is set when drawing.
+        if (shaderObjectsEnabled) {
+            timeStartupPhase("createShaderObjects", [&]() { shaderObjects = createShaderObjects(vertShaderCode, fragShaderCode, graphicsPipelineDescription); });
+            pipelineLayout = shaderObjects.layout;
+            return;
+        }
+
+        // Compiled as a batch on the compiler threads. It's a batch of one for now, but every pipeline this app needs at startup belongs in it, so they compile in parallel.
+        std::vector<PipelineCompiler::Request> requests;
+        requests.push_back({ graphicsPipelineDescription, [&]() { return buildGraphicsPipeline(vertShaderCode, fragShaderCode, graphicsPipelineDescription); } });
+        std::vector<GraphicsPipeline> pipelines;
+        timeStartupPhase("compilePipelines", [&]() { pipelines = PipelineCompiler::wait(pipelineCompiler->compile(std::move(requests))); });
+        GraphicsPipeline pipeline = pipelines[0];
+        graphicsPipeline = pipeline.pipeline;
+        pipelineLayout = pipeline.layout;
+    }
+
+    void createPipelineCompiler() {
+        uint32_t threadCount = settings.compileThreads > 0 ? settings.compileThreads : std::max(1u, std::thread::hardware_concurrency());
+        pipelineCompiler = std::make_unique<PipelineCompiler>(graphicsPipelineCache, threadCount);
+        std::cout << "Pipeline compiler threads: " << threadCount << "\n";
+    }
+
+    // The state of this app's pipeline, drawing the given shaders into the render pass.
+    GraphicsPipelineDescription describeGraphicsPipeline(const ShaderCode& vertShaderCode, const ShaderCode& fragShaderCode) {
+        GraphicsPipelineDescription description;
+        description.vertexShaderHash = fnv1a64(vertShaderCode.code, vertShaderCode.codeSize);
+        description.fragmentShaderHash = fnv1a64(fragShaderCode.code, fragShaderCode.codeSize);
+        description.vertexConstants = specializeShader(vertShaderCode, VK_SHADER_STAGE_VERTEX_BIT);
+        description.fragmentConstants = specializeShader(fragShaderCode, VK_SHADER_STAGE_FRAGMENT_BIT);
+        description.renderPass = renderPass;
+        description.subpass = 0;
+        return description;
+    }
+
+    // The --specialize values for one stage, converted to the types the shader declares its constants with.
+    SpecializationConstants specializeShader(const ShaderCode& shaderCode, VkShaderStageFlagBits stage) {
+        SpecializationConstants constants;
+        bool specialized = std::any_of(settings.specializations.begin(), settings.specializations.end(),
+            [stage](const AppSettings::Specialization& specialization) { return specialization.stage == stage; });
+        if (!specialized) {
+            return constants;
+        }
+
+        ShaderReflection reflection = reflectSpirv(shaderCode.code, shaderCode.codeSize);
+        for (const auto& specialization : settings.specializations) {
+            if (specialization.stage != stage) {
+                continue;
+            }
+            std::string name = std::string(stage == VK_SHADER_STAGE_VERTEX_BIT ? "vert" : "frag") + ":" + std::to_string(specialization.constantId);
+            auto constant = std::find_if(reflection.specializationConstants.begin(), reflection.specializationConstants.end(),
+                [&](const ShaderReflection::SpecializationConstant& c) { return c.constantId == specialization.constantId; });
+            if (constant == reflection.specializationConstants.end()) {
+                throw std::runtime_error("ERROR! The shader has no 32 bit specialization constant " + name + "!");
+            }
+
+            const std::string& value = specialization.value;
+            try {
+                size_t parsed = value.size();
+                switch (constant->type) {
+                case ShaderReflection::SpecializationConstant::Type::Bool:
+                    if (value != "true" && value != "false" && value != "1" && value != "0") {
+                        parsed = 0;
+                    }
+                    constants.set(specialization.constantId, value == "true" || value == "1");
+                    break;
+                case ShaderReflection::SpecializationConstant::Type::Int: {
+                    // Parse wider than 32 bits so out of range values are caught instead of truncated.
+                    long long parsedInt = std::stoll(value, &parsed);
+                    if (parsedInt < INT32_MIN || parsedInt > INT32_MAX) {
+                        throw std::out_of_range(value);
+                    }
+                    constants.set(specialization.constantId, static_cast<int32_t>(parsedInt));
+                    break;
+                }
+                case ShaderReflection::SpecializationConstant::Type::Uint: {
+                    // stoull happily wraps "-1" around to the maximum, so negative numbers are rejected up front.
+                    if (value.find('-') != std::string::npos) {
+                        throw std::invalid_argument(value);
+                    }
+                    unsigned long long parsedUint = std::stoull(value, &parsed);
+                    if (parsedUint > UINT32_MAX) {
+                        throw std::out_of_range(value);
+                    }
+                    constants.set(specialization.constantId, static_cast<uint32_t>(parsedUint));
+                    break;
+                }
+                case ShaderReflection::SpecializationConstant::Type::Float:
+                    constants.set(specialization.constantId, std::stof(value, &parsed));
+                    break;
+                }
+                if (parsed != value.size()) {
+                    throw std::invalid_argument(value);
+                }
+            }
+            catch (const std::logic_error&) {
+                throw std::runtime_error("ERROR! Invalid value " + value + " for specialization constant " + name + "!");
+            }
+        }
+        return constants;
+    }
+
+    // Look up the pipeline for description, and only build it (from the given shaders, which description must have been made from) if it isn't cached yet.
+    GraphicsPipeline getGraphicsPipeline(const ShaderCode& vertShaderCode, const ShaderCode& fragShaderCode, const GraphicsPipelineDescription& description) {
+        GraphicsPipeline pipeline;
+        if (graphicsPipelineCache.find(description, pipeline)) {
+            return pipeline;
+        }
+        return graphicsPipelineCache.getOrCreate(description, [&]() {
+            return buildGraphicsPipeline(vertShaderCode, fragShaderCode, description);
+        });
+    }
+
+    /* Take the current pipeline out of the cache and destroy it once the frames in flight are done with it. Its layout belongs to the layout cache and stays.
+    Pipeline library parts made from shaders that no pipeline uses anymore go with it. Shaders of pipelines that are
+    cached (or being created) and of pending optimized links are still in use, and their parts are kept.*/
+    void retireGraphicsPipeline() {
+        VkPipeline oldPipeline = graphicsPipelineCache.remove(graphicsPipelineDescription);
+        deferDestroy([this, oldPipeline]() {
+            vkDestroyPipeline(device, oldPipeline, nullptr);
+        });
+
+        if (pipelineLibrariesEnabled) {
+            std::set<uint64_t> shaderHashesInUse = graphicsPipelineCache.getShaderHashes();
+            {
+                std::lock_guard<std::mutex> lock(optimizedPipelinesMutex);
+                for (const auto& optimized : optimizedPipelines) {
+                    shaderHashesInUse.insert(optimized.description.vertexShaderHash);
+                    shaderHashesInUse.insert(optimized.description.fragmentShaderHash);
+                }
+            }
+            for (VkPipeline library : pipelineLibraryCache.removeUnused(shaderHashesInUse)) {
+                deferDestroy([this, library]() {
+                    vkDestroyPipeline(device, library, nullptr);
+                });
+            }
+        }
+    }
+
+    // The vertex input state for a vertex shader: its inputs, interleaved in one per-vertex binding (binding 0), in location order.
+    static void describeVertexInput(const ShaderReflection& vertReflection, VkVertexInputBindingDescription& binding, std::vector<VkVertexInputAttributeDescription>& attributes) {
+        binding = {};
+        binding.binding = 0;
+        binding.inputRate = VK_VERTEX_INPUT_RATE_VERTEX;
+        attributes.clear();
+        for (const auto& input : vertReflection.vertexInputs) {
+            VkVertexInputAttributeDescription attribute{};
+            attribute.location = input.location;
+            attribute.binding = 0;
+            attribute.format = input.format;
+            attribute.offset = binding.stride;
+            binding.stride += input.size;
+            attributes.push_back(attribute);
+        }
+        // The shader's inputs have to line up with the vertex buffer's data. No inputs (ie older shaders that index hardcoded arrays with gl_VertexIndex) is fine, the buffer is just ignored.
+        if (binding.stride != 0 && binding.stride != sizeof(Vertex)) {
+            throw std::runtime_error("ERROR! The vertex shader's inputs (" + std::to_string(binding.stride) + " bytes) don't match Vertex (" + std::to_string(sizeof(Vertex)) + " bytes)!");
+        }
+    }
+
+    /* Create a graphics pipeline from the given shaders and state (and get its layout). Use getGraphicsPipeline() rather
+    than calling this directly, so the same state isn't compiled twice. Besides its parameters, this only uses objects
+    that don't change after startup (device, render pass, pipeline cache, which is internally synchronized), so it can
+    run on a background thread (see the shader hot reload).*/
+    GraphicsPipeline buildGraphicsPipeline(const ShaderCode& vertShaderCode, const ShaderCode& fragShaderCode, const GraphicsPipelineDescription& description) {
+        PROFILE_ZONE("buildGraphicsPipeline");
+        // Read what the shaders expect (descriptors, push constants, vertex inputs) from their SPIR-V, so the layout and vertex input state below don't have to be kept in sync with the shaders by hand.
+        ShaderReflection vertReflection = reflectSpirv(vertShaderCode.code, vertShaderCode.codeSize);
+        ShaderReflection fragReflection = reflectSpirv(fragShaderCode.code, fragShaderCode.codeSize);
+        if (vertReflection.stage != VK_SHADER_STAGE_VERTEX_BIT || fragReflection.stage != VK_SHADER_STAGE_FRAGMENT_BIT) {
+            throw std::runtime_error("ERROR! Shader stages don't match (expected a vertex and a fragment shader)!");
+        }
 
+        // ####### Vertex & fragment shader #########
         // Store the bytecode in a thin wrapper (shader module)
-        VkShaderModule vertShaderModule = createShaderModule(vertShaderCode);
+        VkShaderModule vertShaderModule = createShaderModule(vertShaderCode.code, vertShaderCode.codeSize);
         std::cout << "\nVertex shader module created.\n";
-        VkShaderModule fragShaderModule = createShaderModule(fragShaderCode);
+        VkShaderModule fragShaderModule = createShaderModule(fragShaderCode.code, fragShaderCode.codeSize);
         std::cout << "Fragment shader module created.\n";
 
         // To actually use the shaders, need to assign them to a specific pipeline stage through structs.
@@ -1088,13 +5100,20 @@ private:
         // Specify the function to invoke, known as the entrypoint.
         vertShaderStageInfo.pName = "main";
         // This field allows you to specify values for shader constants. More efficient than configuring the shader during render time.
-        vertShaderStageInfo.pSpecializationInfo = nullptr;
+        std::vector<VkSpecializationMapEntry> vertSpecializationEntries;
+        std::vector<uint32_t> vertSpecializationData;
+        VkSpecializationInfo vertSpecialization = description.vertexConstants.getInfo(vertSpecializationEntries, vertSpecializationData);
+        vertShaderStageInfo.pSpecializationInfo = description.vertexConstants.empty() ? nullptr : &vertSpecialization;
 
         VkPipelineShaderStageCreateInfo fragShaderStageInfo{};
         fragShaderStageInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
         fragShaderStageInfo.stage = VK_SHADER_STAGE_FRAGMENT_BIT;
         fragShaderStageInfo.module = fragShaderModule;
         fragShaderStageInfo.pName = "main";
+        std::vector<VkSpecializationMapEntry> fragSpecializationEntries;
+        std::vector<uint32_t> fragSpecializationData;
+        VkSpecializationInfo fragSpecialization = description.fragmentConstants.getInfo(fragSpecializationEntries, fragSpecializationData);
+        fragShaderStageInfo.pSpecializationInfo = description.fragmentConstants.empty() ? nullptr : &fragSpecialization;
 
         // Store the shader structs in an array.
         VkPipelineShaderStageCreateInfo shaderStages[] = { vertShaderStageInfo, fragShaderStageInfo };
@@ -1104,14 +5123,20 @@ private:
         // ########### Vertex input #################
         /* This struct describes the format of the vertex data that will be passed to the vertex shader.
          It describes this through Bindings (spacing b/w data and whether the data is per-vertex or per-instance)
-         and through Attribute descriptions (type of attribs passed to the VS, which binding to load them from & and which offset)*/
+         and through Attribute descriptions (type of attribs passed to the VS, which binding to load them from & and which offset)
+         The attributes come from the vertex shader's inputs. They're interleaved in one per-vertex binding, in location order.*/
+        VkVertexInputBindingDescription vertexBinding{};
+        std::vector<VkVertexInputAttributeDescription> vertexAttributes;
+        describeVertexInput(vertReflection, vertexBinding, vertexAttributes);
+
         VkPipelineVertexInputStateCreateInfo  vertexInputInfo{};
         vertexInputInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_VERTEX_INPUT_STATE_CREATE_INFO;
-        vertexInputInfo.vertexBindingDescriptionCount = 0;            // Vertex data is hardcoded for now
-        vertexInputInfo.pVertexBindingDescriptions = nullptr;      // Optional
-        vertexInputInfo.vertexAttributeDescriptionCount = 0;
-        vertexInputInfo.pVertexAttributeDescriptions = nullptr;      // Optional 
-        std::cout << "Vertex input format specified.\n";
+        // No inputs (like when the vertex data is hardcoded in the shader) means no binding either.
+        vertexInputInfo.vertexBindingDescriptionCount = vertexAttributes.empty() ? 0 : 1;
+        vertexInputInfo.pVertexBindingDescriptions = &vertexBinding;
+        vertexInputInfo.vertexAttributeDescriptionCount = static_cast<uint32_t>(vertexAttributes.size());
+        vertexInputInfo.pVertexAttributeDescriptions = vertexAttributes.data();
+        std::cout << "Vertex input format specified (" << vertexAttributes.size() << " attributes).\n";
         // ##########################################
 
 
@@ -1121,41 +5146,28 @@ private:
         VkPipelineInputAssemblyStateCreateInfo inputAssembly{};
         inputAssembly.sType = VK_STRUCTURE_TYPE_PIPELINE_INPUT_ASSEMBLY_STATE_CREATE_INFO;
         // Draw triangle from every 3 vertices w/o reuse
-        inputAssembly.topology = VK_PRIMITIVE_TOPOLOGY_TRIANGLE_LIST;
+        inputAssembly.topology = description.topology;
         // Used with element buffers to perform optimizations like reusing vertices.
         inputAssembly.primitiveRestartEnable = VK_FALSE;
         std::cout << "Input assembly specified.\n";
-        // ##########################################
-
-
-        // ########## Viewport & scissors ###########
-        /* A viewport basically describes the region of the framebuffer that the output
-        will be rendered to. Almost always (0,0) to (width, height)*/
-        VkViewport viewport{};
-        viewport.x = 0.0f;
-        viewport.y = 0.0f;
-        viewport.width = (float)swapChainExtent.width;
-        viewport.height = (float)swapChainExtent.height;
-        // minDepth can actually be higher than maxDepth. If not doing anything special, keep min=0.0 and max=1.0
-        viewport.minDepth = 0.0f;
-        viewport.maxDepth = 1.0f;
+        // ##########################################
 
-        /* Scissor rectangles define in which region pixels will actually be stored.
-        Any pixels outside the rectangles will be discarded by the rasterizer. They
-        act like a filter rather than a transformation. In this tutorial we want to
-        draw the entire framebuffer, so just define a rectangle that covers it.*/
-        VkRect2D scissor{};
-        scissor.offset = { 0, 0 };
-        scissor.extent = swapChainExtent;
 
-        // Combine the viewport and scissor rectangle into a viewport state.
+        // ########## Viewport & scissors ###########
+        /* A viewport basically describes the region of the framebuffer that the output
+        will be rendered to. Almost always (0,0) to (width, height).
+        Scissor rectangles define in which region pixels will actually be stored.
+        Any pixels outside the rectangles will be discarded by the rasterizer. They
+        act like a filter rather than a transformation.
+        Both are dynamic state (see below), set in the command buffer with the current extent (see recordDraws()), so
+        only their count is given here. That way a resize never has to recompile the pipeline.*/
         VkPipelineViewportStateCreateInfo viewPortState{};
         viewPortState.sType = VK_STRUCTURE_TYPE_PIPELINE_VIEWPORT_STATE_CREATE_INFO;
         viewPortState.viewportCount = 1;
-        viewPortState.pViewports = &viewport;
+        viewPortState.pViewports = nullptr;          // Dynamic
         viewPortState.scissorCount = 1;
-        viewPortState.pScissors = &scissor;
-        std::cout << "Viewport and scissor rectangle specified.\n";
+        viewPortState.pScissors = nullptr;           // Dynamic
+        std::cout << "Viewport and scissor rectangle specified (dynamic).\n";
         // ##########################################
 
 
@@ -1170,12 +5182,12 @@ private:
         // If true, geom never passes through the rasterization stage. This basically disables any output to the framebuffer.
         rasterizer.rasterizerDiscardEnable = VK_FALSE;
         // 3 modes available. FILL, LINE, and POINT. Use FILL to fill the area of the polygon with fragments.
-        rasterizer.polygonMode = VK_POLYGON_MODE_FILL;
+        rasterizer.polygonMode = description.polygonMode;
         // Thickness of the lines in terms of # of fragments. Max width depends on the HW. Anything larger than 1.0f requires you to enabled the wideLines feature.
         rasterizer.lineWidth = 1.0f;
         // Specify the cull mode (for this tutorial, cull the back face). frontFace specifies the vertex order for faces to be considered front-facing.
-        rasterizer.cullMode = VK_CULL_MODE_BACK_BIT;
-        rasterizer.frontFace = VK_FRONT_FACE_CLOCKWISE;
+        rasterizer.cullMode = description.cullMode;
+        rasterizer.frontFace = description.frontFace;
         // Rasterizer can alter the depth vals by adding a constant value or biasing them based on a fragment's slope. Sometimes used for shadow mapping.
         rasterizer.depthBiasEnable = VK_FALSE;
         rasterizer.depthBiasConstantFactor = 0.0f;             // Optional
@@ -1208,6 +5220,7 @@ private:
         // ######### Depth & stentcil Testing #######
         /*If using a depth or stencil buffer need to configure it here.*/
         VkPipelineDepthStencilStateCreateInfo depthAndStencil{};
+        (void)depthAndStencil;  // Not passed to the pipeline until there's a depth buffer
         std::cout << "Depth & stencil tests specified (disabled for now).\n";
         // ##########################################
 
@@ -1225,8 +5238,8 @@ private:
         finalColor.rgb = newAlpha * newColor + (1 - newAlpha) * oldColor;
         finalColor.a = newAlpha.a;*/
         VkPipelineColorBlendAttachmentState colorBlendAttachment{};
-        colorBlendAttachment.colorWriteMask = VK_COLOR_COMPONENT_R_BIT | VK_COLOR_COMPONENT_G_BIT | VK_COLOR_COMPONENT_B_BIT | VK_COLOR_COMPONENT_A_BIT;
-        colorBlendAttachment.blendEnable = VK_FALSE;
+        colorBlendAttachment.colorWriteMask = description.colorWriteMask;
+        colorBlendAttachment.blendEnable = description.blendEnable;
         colorBlendAttachment.srcColorBlendFactor = VK_BLEND_FACTOR_ONE;              // Optional
         colorBlendAttachment.dstColorBlendFactor = VK_BLEND_FACTOR_ZERO;             // Optional
         colorBlendAttachment.colorBlendOp = VK_BLEND_OP_ADD;                  // Optional
@@ -1253,8 +5266,13 @@ private:
 
         // ############# Dynamic state ##############
         /*A limited amount of the state we've specified can be changed w/o recreating the pipeline, like the viewport,
-        line width, and blend constants.*/
-        std::cout << "Dynamic states specified (disabled for now).\n";
+        line width, and blend constants. The viewport and scissor depend on the swap chain extent, so they're dynamic.*/
+        VkDynamicState dynamicStates[] = { VK_DYNAMIC_STATE_VIEWPORT, VK_DYNAMIC_STATE_SCISSOR };
+        VkPipelineDynamicStateCreateInfo dynamicState{};
+        dynamicState.sType = VK_STRUCTURE_TYPE_PIPELINE_DYNAMIC_STATE_CREATE_INFO;
+        dynamicState.dynamicStateCount = static_cast<uint32_t>(sizeof(dynamicStates) / sizeof(dynamicStates[0]));
+        dynamicState.pDynamicStates = dynamicStates;
+        std::cout << "Dynamic states specified (viewport and scissor).\n";
         // ##########################################
 
 
@@ -1263,19 +5281,19 @@ private:
         can be changed at drawing time to alter behavior of shaders w/o having to recreate them. Commonly used to
         pass the transformation matrix to the VS, or to create texture samples in the FS. These uniform values
         must be specified during pipeline creation through a VKPipelineLayout object. Even if not using, need
-        to create an empty layout.*/
-        VkPipelineLayoutCreateInfo pipelineLayoutInfo{};
-        pipelineLayoutInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO;
-        pipelineLayoutInfo.setLayoutCount = 0;            // Optional
-        pipelineLayoutInfo.pSetLayouts = nullptr;      // Optional
-        // The struct also specifies push constants, another way of passing dynamoc vals to shaders.
-        pipelineLayoutInfo.pushConstantRangeCount = 0;            // Optional
-        pipelineLayoutInfo.pPushConstantRanges = nullptr;      // Optional
-
-        if (vkCreatePipelineLayout(device, &pipelineLayoutInfo, nullptr, &pipelineLayout) != VK_SUCCESS) {
-            throw std::runtime_error("ERROR! Failed to create pipeline layout!");
+        to create an empty layout. The layout (descriptor set layouts and push constant range) is built from the shaders'
+        reflection, and the cache hands back the existing layout when another pipeline already needed the same one.
+        The cache owns the layout, so it's never destroyed along with the pipeline.*/
+        GraphicsPipeline pipeline;
+        try {
+            pipeline.layout = pipelineLayoutCache.getPipelineLayout(device, { &vertReflection, &fragReflection });
         }
-        std::cout << "Pipeline layout created.\n";
+        catch (const std::exception&) {
+            vkDestroyShaderModule(device, fragShaderModule, nullptr);
+            vkDestroyShaderModule(device, vertShaderModule, nullptr);
+            throw;
+        }
+        std::cout << "Pipeline layout ready.\n";
         // ##########################################
 
         // ####### Putting it all together  #########
@@ -1292,12 +5310,12 @@ private:
         pipelineInfo.pMultisampleState = &multisampling;
         pipelineInfo.pDepthStencilState = nullptr;           // Optional
         pipelineInfo.pColorBlendState = &colorBlending;
-        pipelineInfo.pDynamicState = nullptr;           // Optional
+        pipelineInfo.pDynamicState = &dynamicState;
         // Next is the pipeline layout, a Vulkan handle rather than a struct pointer
-        pipelineInfo.layout = pipelineLayout;
+        pipelineInfo.layout = pipeline.layout;
         // Then, reference the render pass and the index of the subpass where the graphics pipeline will be used.
-        pipelineInfo.renderPass = renderPass;
-        pipelineInfo.subpass = 0;
+        pipelineInfo.renderPass = description.renderPass;
+        pipelineInfo.subpass = description.subpass;
         /* Vulkan lets you create a new graphics pipeline by deriving from an existing pipeline.
         The idea is it's less expensive to setup pipelines when they have alot of functionality in common with
         an existing one. Can either specify the handle of an existing pipeline or reference another pipeline
@@ -1308,9 +5326,22 @@ private:
         /* Finally, create the pipeline. More params than the usual Vulkan object creation. Designed to take multiple
         VkGraphicsPipelineCreateInfo objects and create multiple VkPipeline objects in one call. The second param references
         an optional VkPipelineCache object, used to store and reuse data relevant to pipeline creation across multiple calls to vkCreateGraphicsPipelines()
-        and even across program executions if the cache is stored in a file.*/
-        if (vkCreateGraphicsPipelines(device, VK_NULL_HANDLE, 1, &pipelineInfo, nullptr, &graphicsPipeline) != VK_SUCCESS) {
-            throw std::runtime_error("ERROR! Failed to create graphics pipeline!");
+        and even across program executions if the cache is stored in a file (see createPipelineCache() and savePipelineCache()).*/
+        VkResult result = VK_SUCCESS;
+        try {
+            if (pipelineLibrariesEnabled) {
+                pipeline.pipeline = createPipelineFromLibraries(pipelineInfo, description);
+            }
+            else {
+                // Runs on a compiler thread, so it shows up in the trace rather than the startup steps (see compilePipelines).
+                PROFILE_ZONE("vkCreateGraphicsPipelines");
+                result = createGraphicsPipelineWithFeedback(pipelineInfo, "pipeline", { description.vertexShaderHash, description.fragmentShaderHash }, &pipeline.pipeline);
+            }
+        }
+        catch (const std::exception&) {
+            vkDestroyShaderModule(device, fragShaderModule, nullptr);
+            vkDestroyShaderModule(device, vertShaderModule, nullptr);
+            throw;
         }
         // ##########################################
 
@@ -1318,6 +5349,332 @@ private:
         because the important bytecode in them has been compiled and linked. */
         vkDestroyShaderModule(device, fragShaderModule, nullptr);
         vkDestroyShaderModule(device, vertShaderModule, nullptr);
+
+        if (result != VK_SUCCESS) {
+            throw std::runtime_error("ERROR! Failed to create graphics pipeline!");
+        }
+        return pipeline;
+    }
+
+    /* Create linked VK_EXT_shader_object shaders from the given shaders, the shader object counterpart of
+    buildGraphicsPipeline(). Only the shaders, their layout and their specialization constants go in, compiling them is
+    all the work there is. The rest of the description is state that's set when drawing (see bindShaderObjects()), so
+    changing it never compiles anything. Like buildGraphicsPipeline(), this can run on a background thread.*/
+    ShaderObjects createShaderObjects(const ShaderCode& vertShaderCode, const ShaderCode& fragShaderCode, const GraphicsPipelineDescription& description) {
+        PROFILE_ZONE("createShaderObjects");
+        ShaderReflection vertReflection = reflectSpirv(vertShaderCode.code, vertShaderCode.codeSize);
+        ShaderReflection fragReflection = reflectSpirv(fragShaderCode.code, fragShaderCode.codeSize);
+        if (vertReflection.stage != VK_SHADER_STAGE_VERTEX_BIT || fragReflection.stage != VK_SHADER_STAGE_FRAGMENT_BIT) {
+            throw std::runtime_error("ERROR! Shader stages don't match (expected a vertex and a fragment shader)!");
+        }
+
+        // Shader objects take the set layouts and push constant range themselves. The pipeline layout made from the same ones is compatible, so descriptors are still bound with it.
+        PipelineLayoutCache::Layout layout = pipelineLayoutCache.getLayout(device, { &vertReflection, &fragReflection });
+
+        std::vector<VkSpecializationMapEntry> vertSpecializationEntries, fragSpecializationEntries;
+        std::vector<uint32_t> vertSpecializationData, fragSpecializationData;
+        VkSpecializationInfo vertSpecialization = description.vertexConstants.getInfo(vertSpecializationEntries, vertSpecializationData);
+        VkSpecializationInfo fragSpecialization = description.fragmentConstants.getInfo(fragSpecializationEntries, fragSpecializationData);
+
+        // Linking the stages lets the driver optimize across them, like it would in a pipeline. Linked shaders have to be created in the same call, and bound together.
+        VkShaderCreateInfoEXT shaderInfos[2]{};
+        shaderInfos[0].sType = VK_STRUCTURE_TYPE_SHADER_CREATE_INFO_EXT;
+        shaderInfos[0].flags = VK_SHADER_CREATE_LINK_STAGE_BIT_EXT;
+        shaderInfos[0].stage = VK_SHADER_STAGE_VERTEX_BIT;
+        shaderInfos[0].nextStage = VK_SHADER_STAGE_FRAGMENT_BIT;
+        shaderInfos[0].codeType = VK_SHADER_CODE_TYPE_SPIRV_EXT;
+        shaderInfos[0].codeSize = vertShaderCode.codeSize;
+        shaderInfos[0].pCode = vertShaderCode.code;
+        shaderInfos[0].pSpecializationInfo = description.vertexConstants.empty() ? nullptr : &vertSpecialization;
+        shaderInfos[1] = shaderInfos[0];
+        shaderInfos[1].stage = VK_SHADER_STAGE_FRAGMENT_BIT;
+        shaderInfos[1].nextStage = 0;
+        shaderInfos[1].codeSize = fragShaderCode.codeSize;
+        shaderInfos[1].pCode = fragShaderCode.code;
+        shaderInfos[1].pSpecializationInfo = description.fragmentConstants.empty() ? nullptr : &fragSpecialization;
+        for (auto& shaderInfo : shaderInfos) {
+            shaderInfo.pName = "main";
+            shaderInfo.setLayoutCount = static_cast<uint32_t>(layout.setLayouts.size());
+            shaderInfo.pSetLayouts = layout.setLayouts.data();
+            shaderInfo.pushConstantRangeCount = layout.pushConstants.size > 0 ? 1 : 0;
+            shaderInfo.pPushConstantRanges = &layout.pushConstants;
+        }
+
+        VkShaderEXT shaders[2] = { VK_NULL_HANDLE, VK_NULL_HANDLE };
+        if (shaderObjectFunctions.createShaders(device, 2, shaderInfos, nullptr, shaders) != VK_SUCCESS) {
+            // On failure some of the shaders may still have been created.
+            for (VkShaderEXT shader : shaders) {
+                if (shader != VK_NULL_HANDLE) {
+                    shaderObjectFunctions.destroyShader(device, shader, nullptr);
+                }
+            }
+            throw std::runtime_error("ERROR! Failed to create shader objects!");
+        }
+
+        ShaderObjects objects;
+        objects.vertex = shaders[0];
+        objects.fragment = shaders[1];
+        objects.layout = layout.pipelineLayout;
+
+        // The same vertex input a pipeline would get, in the form vkCmdSetVertexInputEXT takes.
+        VkVertexInputBindingDescription vertexBinding{};
+        std::vector<VkVertexInputAttributeDescription> vertexAttributes;
+        describeVertexInput(vertReflection, vertexBinding, vertexAttributes);
+        if (!vertexAttributes.empty()) {
+            VkVertexInputBindingDescription2EXT binding{};
+            binding.sType = VK_STRUCTURE_TYPE_VERTEX_INPUT_BINDING_DESCRIPTION_2_EXT;
+            binding.binding = vertexBinding.binding;
+            binding.stride = vertexBinding.stride;
+            binding.inputRate = vertexBinding.inputRate;
+            binding.divisor = 1;
+            objects.vertexBindings.push_back(binding);
+        }
+        for (const auto& vertexAttribute : vertexAttributes) {
+            VkVertexInputAttributeDescription2EXT attribute{};
+            attribute.sType = VK_STRUCTURE_TYPE_VERTEX_INPUT_ATTRIBUTE_DESCRIPTION_2_EXT;
+            attribute.location = vertexAttribute.location;
+            attribute.binding = vertexAttribute.binding;
+            attribute.format = vertexAttribute.format;
+            attribute.offset = vertexAttribute.offset;
+            objects.vertexAttributes.push_back(attribute);
+        }
+        std::cout << "Shader objects created (" << objects.vertexAttributes.size() << " vertex attributes).\n";
+        return objects;
+    }
+
+    // Destroy shader objects once the frames in flight are done with them. Their layout belongs to the layout cache and stays.
+    void retireShaderObjects(const ShaderObjects& objects) {
+        VkShaderEXT vertex = objects.vertex;
+        VkShaderEXT fragment = objects.fragment;
+        deferDestroy([this, vertex, fragment]() {
+            shaderObjectFunctions.destroyShader(device, vertex, nullptr);
+            shaderObjectFunctions.destroyShader(device, fragment, nullptr);
+        });
+    }
+
+    /* Create the pipeline described by pipelineInfo out of VK_EXT_graphics_pipeline_library parts:
+        1) vertex input interface (vertex input and input assembly state),
+        2) pre-rasterization shaders (vertex shader, viewport, rasterizer and dynamic state),
+        3) fragment shader (fragment shader, multisample and depth/stencil state),
+        4) fragment output interface (color blending and multisample state).
+    Each part is only created if no earlier pipeline already needed the same one (see PipelineLibraryCache), and linking
+    them is fast, so a new combination of state doesn't stall a frame for a whole pipeline compile. A link time
+    optimized version of the pipeline, which can run faster on the GPU, is then built on a compiler thread and swapped in
+    by updateOptimizedPipelines(). Throws if a part can't be created or linked.*/
+    VkPipeline createPipelineFromLibraries(const VkGraphicsPipelineCreateInfo& pipelineInfo, const GraphicsPipelineDescription& description) {
+        PROFILE_ZONE("createPipelineFromLibraries");
+        // Parts are keyed by a hash of the state they're made from (and which part they are).
+        auto hashValue = [](uint64_t hash, const auto& value) { return fnv1a64(&value, sizeof(value), hash); };
+        const VkPipelineVertexInputStateCreateInfo* vertexInput = pipelineInfo.pVertexInputState;
+
+        uint64_t vertexInputKey = hashValue(FNV1A64_OFFSET_BASIS, VK_GRAPHICS_PIPELINE_LIBRARY_VERTEX_INPUT_INTERFACE_BIT_EXT);
+        vertexInputKey = fnv1a64(vertexInput->pVertexBindingDescriptions, vertexInput->vertexBindingDescriptionCount * sizeof(VkVertexInputBindingDescription), vertexInputKey);
+        vertexInputKey = fnv1a64(vertexInput->pVertexAttributeDescriptions, vertexInput->vertexAttributeDescriptionCount * sizeof(VkVertexInputAttributeDescription), vertexInputKey);
+        vertexInputKey = hashValue(vertexInputKey, description.topology);
+
+        uint64_t preRasterizationKey = hashValue(FNV1A64_OFFSET_BASIS, VK_GRAPHICS_PIPELINE_LIBRARY_PRE_RASTERIZATION_SHADERS_BIT_EXT);
+        preRasterizationKey = hashValue(preRasterizationKey, description.vertexShaderHash);
+        preRasterizationKey = description.vertexConstants.hash(preRasterizationKey);
+        preRasterizationKey = hashValue(preRasterizationKey, description.polygonMode);
+        preRasterizationKey = hashValue(preRasterizationKey, description.cullMode);
+        preRasterizationKey = hashValue(preRasterizationKey, description.frontFace);
+        preRasterizationKey = hashValue(preRasterizationKey, pipelineInfo.layout);
+        preRasterizationKey = hashValue(preRasterizationKey, description.renderPass);
+        preRasterizationKey = hashValue(preRasterizationKey, description.subpass);
+
+        uint64_t fragmentShaderKey = hashValue(FNV1A64_OFFSET_BASIS, VK_GRAPHICS_PIPELINE_LIBRARY_FRAGMENT_SHADER_BIT_EXT);
+        fragmentShaderKey = hashValue(fragmentShaderKey, description.fragmentShaderHash);
+        fragmentShaderKey = description.fragmentConstants.hash(fragmentShaderKey);
+        fragmentShaderKey = hashValue(fragmentShaderKey, pipelineInfo.layout);
+        fragmentShaderKey = hashValue(fragmentShaderKey, description.renderPass);
+        fragmentShaderKey = hashValue(fragmentShaderKey, description.subpass);
+
+        uint64_t fragmentOutputKey = hashValue(FNV1A64_OFFSET_BASIS, VK_GRAPHICS_PIPELINE_LIBRARY_FRAGMENT_OUTPUT_INTERFACE_BIT_EXT);
+        fragmentOutputKey = hashValue(fragmentOutputKey, description.blendEnable);
+        fragmentOutputKey = hashValue(fragmentOutputKey, description.colorWriteMask);
+        fragmentOutputKey = hashValue(fragmentOutputKey, description.renderPass);
+        fragmentOutputKey = hashValue(fragmentOutputKey, description.subpass);
+
+        // Each part only gets the state that belongs to it. The shader parts need the layout, the render pass and subpass.
+        std::vector<VkPipeline> libraries;
+        libraries.push_back(pipelineLibraryCache.getOrCreate(vertexInputKey, 0, [&]() {
+            VkGraphicsPipelineCreateInfo partInfo{};
+            partInfo.sType = VK_STRUCTURE_TYPE_GRAPHICS_PIPELINE_CREATE_INFO;
+            partInfo.pVertexInputState = pipelineInfo.pVertexInputState;
+            partInfo.pInputAssemblyState = pipelineInfo.pInputAssemblyState;
+            return createPipelineLibrary(partInfo, VK_GRAPHICS_PIPELINE_LIBRARY_VERTEX_INPUT_INTERFACE_BIT_EXT, {});
+        }));
+        libraries.push_back(pipelineLibraryCache.getOrCreate(preRasterizationKey, description.vertexShaderHash, [&]() {
+            VkGraphicsPipelineCreateInfo partInfo{};
+            partInfo.sType = VK_STRUCTURE_TYPE_GRAPHICS_PIPELINE_CREATE_INFO;
+            partInfo.stageCount = 1;
+            partInfo.pStages = &pipelineInfo.pStages[0];
+            partInfo.pViewportState = pipelineInfo.pViewportState;
+            partInfo.pRasterizationState = pipelineInfo.pRasterizationState;
+            partInfo.pDynamicState = pipelineInfo.pDynamicState;
+            partInfo.layout = pipelineInfo.layout;
+            partInfo.renderPass = pipelineInfo.renderPass;
+            partInfo.subpass = pipelineInfo.subpass;
+            return createPipelineLibrary(partInfo, VK_GRAPHICS_PIPELINE_LIBRARY_PRE_RASTERIZATION_SHADERS_BIT_EXT, { description.vertexShaderHash });
+        }));
+        libraries.push_back(pipelineLibraryCache.getOrCreate(fragmentShaderKey, description.fragmentShaderHash, [&]() {
+            VkGraphicsPipelineCreateInfo partInfo{};
+            partInfo.sType = VK_STRUCTURE_TYPE_GRAPHICS_PIPELINE_CREATE_INFO;
+            partInfo.stageCount = 1;
+            partInfo.pStages = &pipelineInfo.pStages[1];
+            partInfo.pMultisampleState = pipelineInfo.pMultisampleState;
+            partInfo.pDepthStencilState = pipelineInfo.pDepthStencilState;
+            partInfo.layout = pipelineInfo.layout;
+            partInfo.renderPass = pipelineInfo.renderPass;
+            partInfo.subpass = pipelineInfo.subpass;
+            return createPipelineLibrary(partInfo, VK_GRAPHICS_PIPELINE_LIBRARY_FRAGMENT_SHADER_BIT_EXT, { description.fragmentShaderHash });
+        }));
+        libraries.push_back(pipelineLibraryCache.getOrCreate(fragmentOutputKey, 0, [&]() {
+            VkGraphicsPipelineCreateInfo partInfo{};
+            partInfo.sType = VK_STRUCTURE_TYPE_GRAPHICS_PIPELINE_CREATE_INFO;
+            partInfo.pColorBlendState = pipelineInfo.pColorBlendState;
+            partInfo.pMultisampleState = pipelineInfo.pMultisampleState;
+            partInfo.renderPass = pipelineInfo.renderPass;
+            partInfo.subpass = pipelineInfo.subpass;
+            return createPipelineLibrary(partInfo, VK_GRAPHICS_PIPELINE_LIBRARY_FRAGMENT_OUTPUT_INTERFACE_BIT_EXT, {});
+        }));
+
+        // Without fast linking, a link is about as slow as an optimized link, so just do the optimized one.
+        if (!pipelineLibraryFastLinking) {
+            return linkPipelineLibraries(libraries, pipelineInfo.layout, true);
+        }
+        VkPipeline pipeline = linkPipelineLibraries(libraries, pipelineInfo.layout, false);
+
+        // The parts stay alive while this description is pending in optimizedPipelines (see retireGraphicsPipeline()), so the background link can use them after this returns.
+        VkPipelineLayout layout = pipelineInfo.layout;
+        std::shared_future<GraphicsPipeline> optimized = pipelineCompiler->compileUncached([this, libraries, layout]() {
+            GraphicsPipeline optimizedPipeline;
+            optimizedPipeline.layout = layout;
+            optimizedPipeline.pipeline = linkPipelineLibraries(libraries, layout, true);
+            return optimizedPipeline;
+        });
+        std::lock_guard<std::mutex> lock(optimizedPipelinesMutex);
+        optimizedPipelines.push_back({ description, optimized });
+        return pipeline;
+    }
+
+    // Create one part of a pipeline. partInfo has the state of that part only, and shaderHashes identify its shader stages (if any).
+    VkPipeline createPipelineLibrary(VkGraphicsPipelineCreateInfo partInfo, VkGraphicsPipelineLibraryFlagsEXT part, const std::vector<uint64_t>& shaderHashes) {
+        PROFILE_ZONE("createPipelineLibrary");
+        VkGraphicsPipelineLibraryCreateInfoEXT libraryInfo{};
+        libraryInfo.sType = VK_STRUCTURE_TYPE_GRAPHICS_PIPELINE_LIBRARY_CREATE_INFO_EXT;
+        libraryInfo.flags = part;
+        partInfo.pNext = &libraryInfo;
+        // Keep what the driver needs to link time optimize pipelines made from this part later.
+        partInfo.flags = VK_PIPELINE_CREATE_LIBRARY_BIT_KHR | VK_PIPELINE_CREATE_RETAIN_LINK_TIME_OPTIMIZATION_INFO_BIT_EXT;
+        partInfo.basePipelineHandle = VK_NULL_HANDLE;
+        partInfo.basePipelineIndex = -1;
+
+        VkPipeline library;
+        if (createGraphicsPipelineWithFeedback(partInfo, "library", shaderHashes, &library) != VK_SUCCESS) {
+            throw std::runtime_error("ERROR! Failed to create graphics pipeline library!");
+        }
+        return library;
+    }
+
+    // Link the four parts into a complete pipeline, with link time optimization (slower to create, maybe faster to run) or without (fast).
+    VkPipeline linkPipelineLibraries(const std::vector<VkPipeline>& libraries, VkPipelineLayout layout, bool optimize) {
+        PROFILE_ZONE("linkPipelineLibraries");
+        VkPipelineLibraryCreateInfoKHR linkInfo{};
+        linkInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_LIBRARY_CREATE_INFO_KHR;
+        linkInfo.libraryCount = static_cast<uint32_t>(libraries.size());
+        linkInfo.pLibraries = libraries.data();
+
+        VkGraphicsPipelineCreateInfo pipelineInfo{};
+        pipelineInfo.sType = VK_STRUCTURE_TYPE_GRAPHICS_PIPELINE_CREATE_INFO;
+        pipelineInfo.pNext = &linkInfo;
+        pipelineInfo.flags = optimize ? VK_PIPELINE_CREATE_LINK_TIME_OPTIMIZATION_BIT_EXT : 0;
+        pipelineInfo.layout = layout;
+        pipelineInfo.basePipelineHandle = VK_NULL_HANDLE;
+        pipelineInfo.basePipelineIndex = -1;
+
+        VkPipeline pipeline;
+        if (createGraphicsPipelineWithFeedback(pipelineInfo, optimize ? "optimized_link" : "link", {}, &pipeline) != VK_SUCCESS) {
+            throw std::runtime_error("ERROR! Failed to link graphics pipeline libraries!");
+        }
+        return pipeline;
+    }
+
+    /* Create one pipeline with vkCreateGraphicsPipelines (through the pipeline cache), chaining
+    VkPipelineCreationFeedbackCreateInfo onto pipelineInfo when the device has the extension, and record how it went in
+    pipelineCreationStats. kind says what's being created, and shaderHashes identify pipelineInfo's stages, in order.*/
+    VkResult createGraphicsPipelineWithFeedback(VkGraphicsPipelineCreateInfo pipelineInfo, const char* kind, const std::vector<uint64_t>& shaderHashes, VkPipeline* pipeline) {
+        // One feedback for the whole pipeline, and one per stage, in pStages order.
+        VkPipelineCreationFeedback pipelineFeedback{};
+        std::vector<VkPipelineCreationFeedback> stageFeedbacks(pipelineInfo.stageCount);
+        VkPipelineCreationFeedbackCreateInfo feedbackInfo{};
+        if (pipelineCreationFeedbackEnabled) {
+            feedbackInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_CREATION_FEEDBACK_CREATE_INFO;
+            feedbackInfo.pNext = pipelineInfo.pNext;
+            feedbackInfo.pPipelineCreationFeedback = &pipelineFeedback;
+            feedbackInfo.pipelineStageCreationFeedbackCount = pipelineInfo.stageCount;
+            feedbackInfo.pPipelineStageCreationFeedbacks = stageFeedbacks.data();
+            pipelineInfo.pNext = &feedbackInfo;
+        }
+
+        Clock::time_point start = Clock::now();
+        VkResult result = vkCreateGraphicsPipelines(device, pipelineCache, 1, &pipelineInfo, nullptr, pipeline);
+        double wallMs = elapsedMilliseconds(start, Clock::now());
+        if (result != VK_SUCCESS) {
+            return result;
+        }
+
+        // The driver's durations are in nanoseconds, and are only there if it set the valid bit.
+        auto isValid = [](const VkPipelineCreationFeedback& feedback) { return (feedback.flags & VK_PIPELINE_CREATION_FEEDBACK_VALID_BIT) != 0; };
+        auto isCacheHit = [](const VkPipelineCreationFeedback& feedback) { return (feedback.flags & VK_PIPELINE_CREATION_FEEDBACK_APPLICATION_PIPELINE_CACHE_HIT_BIT) != 0; };
+        PipelineCreationStats::Record record;
+        record.kind = kind;
+        record.feedback = isValid(pipelineFeedback);
+        record.ms = record.feedback ? pipelineFeedback.duration / 1e6 : wallMs;
+        record.cacheHit = record.feedback && isCacheHit(pipelineFeedback);
+        for (uint32_t i = 0; i < pipelineInfo.stageCount; i++) {
+            if (!isValid(stageFeedbacks[i])) {
+                continue;
+            }
+            uint64_t shaderHash = i < shaderHashes.size() ? shaderHashes[i] : 0;
+            record.stages.push_back({ pipelineInfo.pStages[i].stage, shaderHash, stageFeedbacks[i].duration / 1e6, isCacheHit(stageFeedbacks[i]) });
+        }
+        std::cout << "Created " << kind << " in " << record.ms << " ms" << (record.cacheHit ? " (pipeline cache hit)" : "") << ".\n";
+        pipelineCreationStats.record(std::move(record));
+        return result;
+    }
+
+    /* Called once per frame, before drawFrame(). Replaces fast-linked pipelines with their link time optimized versions
+    once those are built. The fast-linked pipeline may still be used by frames in flight, so it goes to deferDestroy().*/
+    void updateOptimizedPipelines() {
+        std::lock_guard<std::mutex> lock(optimizedPipelinesMutex);
+        for (auto optimized = optimizedPipelines.begin(); optimized != optimizedPipelines.end(); ) {
+            if (optimized->pipeline.wait_for(std::chrono::seconds(0)) != std::future_status::ready) {
+                ++optimized;
+                continue;
+            }
+            try {
+                GraphicsPipeline pipeline = optimized->pipeline.get();
+                VkPipeline oldPipeline = graphicsPipelineCache.replace(optimized->description, pipeline);
+                if (oldPipeline == VK_NULL_HANDLE) {
+                    // The fast-linked pipeline was retired while this was being built (ie its shaders were reloaded), so nothing will use this one.
+                    vkDestroyPipeline(device, pipeline.pipeline, nullptr);
+                }
+                else {
+                    if (optimized->description == graphicsPipelineDescription) {
+                        graphicsPipeline = pipeline.pipeline;
+                    }
+                    deferDestroy([this, oldPipeline]() {
+                        vkDestroyPipeline(device, oldPipeline, nullptr);
+                    });
+                    optimizedPipelineCount++;
+                }
+            }
+            catch (const std::exception& e) {
+                std::cerr << e.what() << "\nKeeping the fast-linked pipeline.\n";
+            }
+            optimized = optimizedPipelines.erase(optimized);
+        }
     }
     // ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
 
@@ -1326,6 +5683,7 @@ private:
     
     // Create framebuffers to reference image views that hold attachment information.
     void createFramebuffers() {
+        PROFILE_ZONE("createFramebuffers");
         // There needs to be a framebuffer for each image view in the swapchain.
         swapChainFramebuffers.resize(swapChainImageViews.size());
 
@@ -1351,82 +5709,301 @@ private:
     }
 
 
-    // Create the command pool, which holds the command buffers
-    void createCommandPool() {
+    // Create the command pools, which hold the command buffers. One per frame in flight, so a frame's pool can be reset while the other frames' command buffers are still executing.
+    void createCommandPools() {
+        PROFILE_ZONE("createCommandPools");
         QueueFamilyIndices queueFamilyIndices = findQueueFamilies(physicalDevice);
 
         VkCommandPoolCreateInfo poolInfo{};
         poolInfo.sType            = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO;
         // Each command pool can only allocate CBs that are submitted on single type of queue. We're going to record commands for drawing.
         poolInfo.queueFamilyIndex = queueFamilyIndices.graphicsFamily.value();
-        poolInfo.flags            = 0;         // Optional
+        // The command buffers are short-lived (re-recorded every frame), which lets the driver pick a cheaper allocation strategy. The buffers are never reset individually, since resetting the whole pool at once is cheaper, so no VK_COMMAND_POOL_CREATE_RESET_COMMAND_BUFFER_BIT.
+        poolInfo.flags            = VK_COMMAND_POOL_CREATE_TRANSIENT_BIT;
 
-        if (vkCreateCommandPool(device, &poolInfo, nullptr, &commandPool) != VK_SUCCESS) {
-            throw std::runtime_error("ERROR! Failed to create command pool!");
+        frameCommandPools.resize(frameSlotCount);
+        for (size_t i = 0; i < frameCommandPools.size(); i++) {
+            if (vkCreateCommandPool(device, &poolInfo, nullptr, &frameCommandPools[i]) != VK_SUCCESS) {
+                throw std::runtime_error("ERROR! Failed to create command pool!");
+            }
         }
     }
 
-    // Create command buffers to hold commands, like drawing commands
+    // Allocate a command buffer for each frame in flight. They're recorded in drawFrame() (see recordCommandBuffer()), so only need to be allocated once. Resetting the pool puts them back in the initial state, ready to be recorded again.
     void createCommandBuffers() {
-        commandBuffers.resize(swapChainFramebuffers.size());
+        PROFILE_ZONE("createCommandBuffers");
+        commandBuffers.resize(frameCommandPools.size());
+
+        for (size_t i = 0; i < commandBuffers.size(); i++) {
+            VkCommandBufferAllocateInfo allocInfo{};
+            allocInfo.sType                 = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
+            allocInfo.commandPool           = frameCommandPools[i];
+            // Primary or Secondary. Secondary means cannot be submitted directly to the queue for execution but can be called from primary command buffers. Primary means they can be submitted to the queue for execution, but cant be called from other command buffers.
+            allocInfo.level                 = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
+            allocInfo.commandBufferCount    = 1;
+
+            if (vkAllocateCommandBuffers(device, &allocInfo, &commandBuffers[i]) != VK_SUCCESS) {
+                throw std::runtime_error("ERROR! Failed to allocate command buffers!");
+            }
+        }
+    }
 
-        // Allocate a bunch of command buffers at once, based on the number of framebuffers. You need to record a command buffer for every image in the swap chain.
-        VkCommandBufferAllocateInfo allocInfo{};
-        allocInfo.sType                 = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
-        allocInfo.commandPool           = commandPool;
-        // Primary or Secondary. Secondary means cannot be submitted directly to the queue for execution but can be called from primary command buffers. Primary means they can be submitted to the queue for execution, but cant be called from other command buffers.
-        allocInfo.level                 = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
-        allocInfo.commandBufferCount    = (uint32_t)commandBuffers.size();
+    // Start the worker threads, and create a command pool for each of them for every frame in flight.
+    void createRecordingThreads() {
+        PROFILE_ZONE("createRecordingThreads");
+        QueueFamilyIndices queueFamilyIndices = findQueueFamilies(physicalDevice);
+
+        VkCommandPoolCreateInfo poolInfo{};
+        poolInfo.sType            = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO;
+        poolInfo.queueFamilyIndex = queueFamilyIndices.graphicsFamily.value();
+        poolInfo.flags            = VK_COMMAND_POOL_CREATE_TRANSIENT_BIT;
+
+        workerCommandPools.resize(static_cast<size_t>(frameSlotCount) * settings.recordThreads);
+        for (auto& workerPool : workerCommandPools) {
+            if (vkCreateCommandPool(device, &poolInfo, nullptr, &workerPool.pool) != VK_SUCCESS) {
+                throw std::runtime_error("ERROR! Failed to create worker command pool!");
+            }
+        }
+
+        recordingThreads = std::make_unique<WorkerThreadPool>(settings.recordThreads);
+        std::cout << "Recording threads: " << settings.recordThreads << "\n";
+    }
+
+    // Bind the pipeline (or shader objects) and the vertex and index buffers, and record drawCount draws of the triangle.
+    void recordDraws(VkCommandBuffer commandBuffer, uint32_t drawCount) {
+        // The viewport and scissor are dynamic state, so set them to cover the whole framebuffer. Dynamic state isn't inherited by secondary command buffers either.
+        VkViewport viewport{};
+        viewport.x = 0.0f;
+        viewport.y = 0.0f;
+        viewport.width = (float)swapChainExtent.width;
+        viewport.height = (float)swapChainExtent.height;
+        // minDepth can actually be higher than maxDepth. If not doing anything special, keep min=0.0 and max=1.0
+        viewport.minDepth = 0.0f;
+        viewport.maxDepth = 1.0f;
+
+        VkRect2D scissor{};
+        scissor.offset = { 0, 0 };
+        scissor.extent = swapChainExtent;
+
+        if (shaderObjectsEnabled) {
+            bindShaderObjects(commandBuffer, viewport, scissor);
+        }
+        else {
+            // Now, bind the graphics pipeline to the command buffer. State isn't inherited between secondary command buffers, so every one of them binds it again.
+            vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, graphicsPipeline);
+            vkCmdSetViewport(commandBuffer, 0, 1, &viewport);
+            vkCmdSetScissor(commandBuffer, 0, 1, &scissor);
+        }
 
-        if (vkAllocateCommandBuffers(device, &allocInfo, commandBuffers.data
-        ()) != VK_SUCCESS) {
-            throw std::runtime_error("ERROR! Failed to allocate command buffers!");
+        // Bind the vertex buffer to binding 0 (the one the vertex input state describes), and the index buffer.
+        VkDeviceSize vertexBufferOffset = 0;
+        vkCmdBindVertexBuffers(commandBuffer, 0, 1, &vertexBuffer, &vertexBufferOffset);
+        vkCmdBindIndexBuffer(commandBuffer, indexBuffer, 0, VK_INDEX_TYPE_UINT16);
+
+        // We've now told Vulkan which operations to execute in the graphics pipeline and which attachment to use in the fragment shader. So finally tell it to dtaw a triangle.
+
+        // A bit anticlimactic, because all of the info was specified in advance. The params are the CB, index count, instance count (1 if not doing that), first index (offset in index buffer), vertex offset (added to each index), first instance (offset for instanced rendering)
+        for (uint32_t i = 0; i < drawCount; i++) {
+            vkCmdDrawIndexed(commandBuffer, static_cast<uint32_t>(indices.size()), 1, 0, 0, 0);
+        }
+    }
+
+    /* Bind the shader objects and set all of the state a pipeline would have baked in, from graphicsPipelineDescription
+    and the same fixed values buildGraphicsPipeline() uses. With shader objects every piece of state the draw depends on
+    must be set, or it's undefined. State that depends on a feature this app doesn't enable (depth bounds, depth clamp,
+    logic op, alpha to one, wide lines) is left out, as it doesn't exist then. Like with a pipeline, none of this is
+    inherited between secondary command buffers, so each one sets it all.*/
+    void bindShaderObjects(VkCommandBuffer commandBuffer, const VkViewport& viewport, const VkRect2D& scissor) {
+        const ShaderObjectFunctions& f = shaderObjectFunctions;
+        const GraphicsPipelineDescription& description = graphicsPipelineDescription;
+        VkShaderStageFlagBits stages[] = { VK_SHADER_STAGE_VERTEX_BIT, VK_SHADER_STAGE_FRAGMENT_BIT };
+        VkShaderEXT shaders[] = { shaderObjects.vertex, shaderObjects.fragment };
+        f.cmdBindShaders(commandBuffer, 2, stages, shaders);
+
+        // Vertex input & input assembly
+        f.cmdSetVertexInput(commandBuffer, static_cast<uint32_t>(shaderObjects.vertexBindings.size()), shaderObjects.vertexBindings.data(),
+            static_cast<uint32_t>(shaderObjects.vertexAttributes.size()), shaderObjects.vertexAttributes.data());
+        f.cmdSetPrimitiveTopology(commandBuffer, description.topology);
+        f.cmdSetPrimitiveRestartEnable(commandBuffer, VK_FALSE);
+
+        // Viewport & scissor
+        f.cmdSetViewportWithCount(commandBuffer, 1, &viewport);
+        f.cmdSetScissorWithCount(commandBuffer, 1, &scissor);
+
+        // Rasterizer
+        f.cmdSetRasterizerDiscardEnable(commandBuffer, VK_FALSE);
+        f.cmdSetPolygonMode(commandBuffer, description.polygonMode);
+        f.cmdSetCullMode(commandBuffer, description.cullMode);
+        f.cmdSetFrontFace(commandBuffer, description.frontFace);
+        f.cmdSetDepthBiasEnable(commandBuffer, VK_FALSE);
+        bool drawsLines = description.polygonMode == VK_POLYGON_MODE_LINE || description.topology == VK_PRIMITIVE_TOPOLOGY_LINE_LIST
+            || description.topology == VK_PRIMITIVE_TOPOLOGY_LINE_STRIP;
+        if (drawsLines) {
+            vkCmdSetLineWidth(commandBuffer, 1.0f);
+        }
+
+        // Multisampling
+        VkSampleMask sampleMask = ~0u;
+        f.cmdSetRasterizationSamples(commandBuffer, VK_SAMPLE_COUNT_1_BIT);
+        f.cmdSetSampleMask(commandBuffer, VK_SAMPLE_COUNT_1_BIT, &sampleMask);
+        f.cmdSetAlphaToCoverageEnable(commandBuffer, VK_FALSE);
+
+        // Depth & stencil
+        f.cmdSetDepthTestEnable(commandBuffer, VK_FALSE);
+        f.cmdSetDepthWriteEnable(commandBuffer, VK_FALSE);
+        f.cmdSetStencilTestEnable(commandBuffer, VK_FALSE);
+
+        // Color blending, for the one color attachment
+        VkBool32 blendEnable = description.blendEnable;
+        f.cmdSetColorBlendEnable(commandBuffer, 0, 1, &blendEnable);
+        f.cmdSetColorWriteMask(commandBuffer, 0, 1, &description.colorWriteMask);
+        if (blendEnable) {
+            VkColorBlendEquationEXT blendEquation{};
+            blendEquation.srcColorBlendFactor = VK_BLEND_FACTOR_ONE;
+            blendEquation.dstColorBlendFactor = VK_BLEND_FACTOR_ZERO;
+            blendEquation.colorBlendOp = VK_BLEND_OP_ADD;
+            blendEquation.srcAlphaBlendFactor = VK_BLEND_FACTOR_ONE;
+            blendEquation.dstAlphaBlendFactor = VK_BLEND_FACTOR_ZERO;
+            blendEquation.alphaBlendOp = VK_BLEND_OP_ADD;
+            f.cmdSetColorBlendEquation(commandBuffer, 0, 1, &blendEquation);
+        }
+    }
+
+    /* Split the frame's draws into one batch per worker thread and record each batch into a secondary command buffer
+    on the workers. Each worker only touches its own command pool for this frame in flight, so no locking is needed.
+    The secondary command buffers are stored in frameSecondaryCommandBuffers in draw order.*/
+    void recordSecondaryCommandBuffers(uint32_t imageIndex, size_t frameSlot) {
+        PROFILE_ZONE("recordSecondaryCommandBuffers");
+        const uint32_t threadCount = recordingThreads->getThreadCount();
+        const uint32_t batchCount = std::min(threadCount, settings.drawCount);
+        // Split the draws evenly: batch b records the draws in [b * drawCount / batchCount, (b + 1) * drawCount / batchCount). There are no more batches than draws, so none of them is empty.
+        auto batchStart = [this, batchCount](uint32_t batch) { return static_cast<uint32_t>(static_cast<uint64_t>(batch) * settings.drawCount / batchCount); };
+        std::atomic<uint32_t> recordedDraws{ 0 };
+
+        // The last frame that used this frame in flight's pools is done, so reset them as a whole, like the primary's pool.
+        WorkerCommandPool* framePools = &workerCommandPools[frameSlot * threadCount];
+        for (uint32_t t = 0; t < threadCount; t++) {
+            if (vkResetCommandPool(device, framePools[t].pool, 0) != VK_SUCCESS) {
+                throw std::runtime_error("ERROR! Failed to reset worker command pool!");
+            }
+            framePools[t].used = 0;
         }
+        frameSecondaryCommandBuffers.assign(batchCount, VK_NULL_HANDLE);
+
+        recordingThreads->parallelFor(batchCount, [&](uint32_t threadIndex, uint32_t batch) {
+            PROFILE_ZONE("recordSecondaryBatch");
+            WorkerCommandPool& workerPool = framePools[threadIndex];
+            // A thread can end up with more than one batch, so allocate more secondary command buffers from its pool when it runs out.
+            if (workerPool.used == workerPool.secondaryCommandBuffers.size()) {
+                VkCommandBufferAllocateInfo allocInfo{};
+                allocInfo.sType                 = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
+                allocInfo.commandPool           = workerPool.pool;
+                allocInfo.level                 = VK_COMMAND_BUFFER_LEVEL_SECONDARY;
+                allocInfo.commandBufferCount    = 1;
+
+                VkCommandBuffer newCommandBuffer;
+                if (vkAllocateCommandBuffers(device, &allocInfo, &newCommandBuffer) != VK_SUCCESS) {
+                    throw std::runtime_error("ERROR! Failed to allocate secondary command buffer!");
+                }
+                workerPool.secondaryCommandBuffers.push_back(newCommandBuffer);
+            }
+            VkCommandBuffer commandBuffer = workerPool.secondaryCommandBuffers[workerPool.used++];
+
+            // Secondary command buffers executed inside a render pass have to say which render pass, subpass and framebuffer they will be used with.
+            VkCommandBufferInheritanceInfo inheritanceInfo{};
+            inheritanceInfo.sType       = VK_STRUCTURE_TYPE_COMMAND_BUFFER_INHERITANCE_INFO;
+            inheritanceInfo.renderPass  = renderPass;
+            inheritanceInfo.subpass     = 0;
+            inheritanceInfo.framebuffer = swapChainFramebuffers[imageIndex];
 
-        // Now, start 'recording' each command buffer with a small VkCommandBufferBeginInfo struct which specifies some details about the usage of this specific command buffer. Then, start the render pass to fill in the command buffer with more info.
-        for (size_t i = 0; i < commandBuffers.size(); i++){
             VkCommandBufferBeginInfo beginInfo{};
             beginInfo.sType             = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
-            beginInfo.flags             = 0;       // Optional
-            beginInfo.pInheritanceInfo  = nullptr; // Optional. Only relevant for secondary command buffers.
+            // RENDER_PASS_CONTINUE means the whole secondary command buffer runs inside the render pass begun by the primary.
+            beginInfo.flags             = VK_COMMAND_BUFFER_USAGE_RENDER_PASS_CONTINUE_BIT | VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+            beginInfo.pInheritanceInfo  = &inheritanceInfo;
+
+            if (vkBeginCommandBuffer(commandBuffer, &beginInfo) != VK_SUCCESS) {
+                throw std::runtime_error("ERROR! Failed to begin recording secondary command buffer!");
+            }
 
-            if (vkBeginCommandBuffer(commandBuffers[i], &beginInfo) != VK_SUCCESS) {
-                throw std::runtime_error("ERROR! Failed to begin recording command buffer!");
+            const uint32_t batchDraws = batchStart(batch + 1) - batchStart(batch);
+            recordDraws(commandBuffer, batchDraws);
+            recordedDraws += batchDraws;
+
+            if (vkEndCommandBuffer(commandBuffer) != VK_SUCCESS) {
+                throw std::runtime_error("ERROR! Failed to record secondary command buffer!");
             }
+            frameSecondaryCommandBuffers[batch] = commandBuffer;
+        });
 
-            // Drawing starts by beginning the render pass. The render pass will help fill the command buffers with commands.
-            VkRenderPassBeginInfo renderPassInfo{};
-            renderPassInfo.sType = VK_STRUCTURE_TYPE_RENDER_PASS_BEGIN_INFO;
-            renderPassInfo.renderPass = renderPass;
-            // We created a framebuffer for each swap chain image that specifies a color attachment.
-            renderPassInfo.framebuffer = swapChainFramebuffers[i];
-            // Define the size of the render area. The render area defines where shader loads and stores will take place.
-            renderPassInfo.renderArea.offset = { 0, 0 };
-            renderPassInfo.renderArea.extent = swapChainExtent;
-            // Define the clear value to use when clearing the screen. This is black with 100% opacity.
-            VkClearValue clearColor = { 0.0f, 0.0f, 0.0f, 1.0f };
-            renderPassInfo.clearValueCount = 1;
-            renderPassInfo.pClearValues = &clearColor;
+        // The benchmark compares runs by draw count, so a frame with the wrong number of draws would silently skew it.
+        if (recordedDraws != settings.drawCount) {
+            throw std::runtime_error("ERROR! Recorded " + std::to_string(recordedDraws.load()) + " draws instead of " + std::to_string(settings.drawCount) + "!");
+        }
+    }
 
-            // Begin the render pass and begin recording commands! The final param regards primary vs secondary command buffers.
-            vkCmdBeginRenderPass(commandBuffers[i], &renderPassInfo, VK_SUBPASS_CONTENTS_INLINE);
+    // Record the commands to draw a frame into the given swap chain image. frameSlot is the frame in flight being recorded, which picks the timestamp query pair and the worker command pools.
+    void recordCommandBuffer(VkCommandBuffer commandBuffer, uint32_t imageIndex, size_t frameSlot) {
+        PROFILE_ZONE("recordCommandBuffer");
+        const uint32_t queryIndex = static_cast<uint32_t>(frameSlot);
 
-            
-            // Now, bind the graphics pipeline to each command buffer. 
-            vkCmdBindPipeline(commandBuffers[i], VK_PIPELINE_BIND_POINT_GRAPHICS, graphicsPipeline);
+        // With worker threads, record the draws first, so the primary only has to execute them.
+        if (recordingThreads) {
+            recordSecondaryCommandBuffers(imageIndex, frameSlot);
+        }
 
-            // We've now told Vulkan which operations to execute in the graphics pipeline and which attachment to use in the fragment shader. So finally tell it to dtaw a triangle.
+        // Start 'recording' the command buffer with a small VkCommandBufferBeginInfo struct which specifies some details about the usage of this specific command buffer. Then, start the render pass to fill in the command buffer with more info.
+        VkCommandBufferBeginInfo beginInfo{};
+        beginInfo.sType             = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+        // The command buffer is submitted once and then re-recorded, which lets the driver skip preparing it for reuse.
+        beginInfo.flags             = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+        beginInfo.pInheritanceInfo  = nullptr; // Optional. Only relevant for secondary command buffers.
 
-            // A bit anticlimactic, because all of the info was specified in advance. The params are the CB, vertex count, instance count (1 if not doing that), first vertex (offset in vertex buffer), first instance (offset for instanced rendering)
-            vkCmdDraw(commandBuffers[i], 3, 1, 0, 0);
+        if (vkBeginCommandBuffer(commandBuffer, &beginInfo) != VK_SUCCESS) {
+            throw std::runtime_error("ERROR! Failed to begin recording command buffer!");
+        }
 
-            // Finally, end the render pass and ...
-            vkCmdEndRenderPass(commandBuffers[i]);
+        // Drawing starts by beginning the render pass. The render pass will help fill the command buffers with commands.
+        VkRenderPassBeginInfo renderPassInfo{};
+        renderPassInfo.sType = VK_STRUCTURE_TYPE_RENDER_PASS_BEGIN_INFO;
+        renderPassInfo.renderPass = renderPass;
+        // We created a framebuffer for each swap chain image that specifies a color attachment.
+        renderPassInfo.framebuffer = swapChainFramebuffers[imageIndex];
+        // Define the size of the render area. The render area defines where shader loads and stores will take place.
+        renderPassInfo.renderArea.offset = { 0, 0 };
+        renderPassInfo.renderArea.extent = swapChainExtent;
+        // Define the clear value to use when clearing the screen. This is black with 100% opacity.
+        VkClearValue clearColor = { 0.0f, 0.0f, 0.0f, 1.0f };
+        renderPassInfo.clearValueCount = 1;
+        renderPassInfo.pClearValues = &clearColor;
+
+        // If GPU timing is on, write a timestamp before the render pass starts. The queries have to be reset before they can be written again, and resets aren't allowed inside a render pass.
+        if (timestampQueryPool != VK_NULL_HANDLE) {
+            vkCmdResetQueryPool(commandBuffer, timestampQueryPool, 2 * queryIndex, 2);
+            vkCmdWriteTimestamp(commandBuffer, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, timestampQueryPool, 2 * queryIndex);
+        }
 
-            // ... end the command buffer it's done recording commands
-            if (vkEndCommandBuffer(commandBuffers[i]) != VK_SUCCESS) {
-                throw std::runtime_error("ERROR! Failed to record command buffer!");
-            }
+        // Begin the render pass and begin recording commands! The final param regards primary vs secondary command buffers. A render pass's contents are either all inline, or all in secondary command buffers.
+        if (recordingThreads) {
+            vkCmdBeginRenderPass(commandBuffer, &renderPassInfo, VK_SUBPASS_CONTENTS_SECONDARY_COMMAND_BUFFERS);
+            vkCmdExecuteCommands(commandBuffer, static_cast<uint32_t>(frameSecondaryCommandBuffers.size()), frameSecondaryCommandBuffers.data());
+        }
+        else {
+            vkCmdBeginRenderPass(commandBuffer, &renderPassInfo, VK_SUBPASS_CONTENTS_INLINE);
+            recordDraws(commandBuffer, settings.drawCount);
+        }
+
+        // Finally, end the render pass and ...
+        vkCmdEndRenderPass(commandBuffer);
+
+        // ... write the second timestamp once all of the render pass's work has finished, and ...
+        if (timestampQueryPool != VK_NULL_HANDLE) {
+            vkCmdWriteTimestamp(commandBuffer, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, timestampQueryPool, 2 * queryIndex + 1);
+        }
+
+        // ... end the command buffer it's done recording commands
+        if (vkEndCommandBuffer(commandBuffer) != VK_SUCCESS) {
+            throw std::runtime_error("ERROR! Failed to record command buffer!");
         }
     }
     // ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
@@ -1438,105 +6015,543 @@ private:
 
     // Create semaphores for syncing up operations across command queues (drawing and presentation) for each frame. Create fences for syncing up the CPU and GPU (so CPU isn't submitting too much/little work). Also create fences to make sure a swap chain image isn't rendered to if it's already in-flight
     void createSyncObjects() {
-        imageAvailableSemaphores.resize(MAX_FRAMES_IN_FLIGHT);
-        renderFinishedSemaphores.resize(MAX_FRAMES_IN_FLIGHT);
-        inFlightFences.resize(MAX_FRAMES_IN_FLIGHT);
-        // Explicitly initialize to no fence since initially not a single frame is using a swap chain image.
-        imagesInFlight.resize(swapChainImages.size(), VK_NULL_HANDLE);
+        PROFILE_ZONE("createSyncObjects");
+        imageAvailableSemaphores.resize(frameSlotCount);
+        renderFinishedSemaphores.resize(frameSlotCount);
 
         VkSemaphoreCreateInfo semaphoreInfo{};
         semaphoreInfo.sType = VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO;
-        
+
+        // With timeline semaphores, a single timeline semaphore replaces all of the fences. Presentation can only wait on binary semaphores though, so the per-frame imageAvailable/renderFinished semaphores are still needed.
+        if (timelineSemaphoresEnabled) {
+            for (size_t i = 0; i < frameSlotCount; i++) {
+                if (vkCreateSemaphore(device, &semaphoreInfo, nullptr, &imageAvailableSemaphores[i]) != VK_SUCCESS || vkCreateSemaphore(device, &semaphoreInfo, nullptr, &renderFinishedSemaphores[i]) != VK_SUCCESS) {
+                    throw std::runtime_error("ERROR! Failed to create synchronization objects for a frame!");
+                }
+            }
+
+            // The semaphore type is chained onto the regular create info. Start the counter at 0, which means "no frame has finished yet".
+            VkSemaphoreTypeCreateInfoKHR timelineInfo{};
+            timelineInfo.sType = VK_STRUCTURE_TYPE_SEMAPHORE_TYPE_CREATE_INFO_KHR;
+            timelineInfo.semaphoreType = VK_SEMAPHORE_TYPE_TIMELINE_KHR;
+            timelineInfo.initialValue = 0;
+
+            VkSemaphoreCreateInfo timelineSemaphoreInfo{};
+            timelineSemaphoreInfo.sType = VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO;
+            timelineSemaphoreInfo.pNext = &timelineInfo;
+
+            if (vkCreateSemaphore(device, &timelineSemaphoreInfo, nullptr, &frameTimelineSemaphore) != VK_SUCCESS) {
+                throw std::runtime_error("ERROR! Failed to create frame timeline semaphore!");
+            }
+
+            // A value of 0 is already reached, so waiting on it never blocks.
+            frameTimelineValues.assign(frameSlotCount, 0);
+            imageTimelineValues.assign(swapChainImages.size(), 0);
+            return;
+        }
+
+        inFlightFences.resize(frameSlotCount);
+        frameTimelineValues.assign(frameSlotCount, 0);
+        // Explicitly initialize to no fence since initially not a single frame is using a swap chain image.
+        imagesInFlight.resize(swapChainImages.size(), VK_NULL_HANDLE);
+
         // Fences are created in the unsignaled state, so vkWaitForFences in drawFrame() will wait forever if we haven't used the fence before, so for the first fence that is created, init to the signaled state as if we renderws an initial frame that finished.
         VkFenceCreateInfo fenceInfo{};
         fenceInfo.sType = VK_STRUCTURE_TYPE_FENCE_CREATE_INFO;
         fenceInfo.flags = VK_FENCE_CREATE_SIGNALED_BIT;
 
-        for (size_t i = 0; i < MAX_FRAMES_IN_FLIGHT; i++) {
+        for (size_t i = 0; i < frameSlotCount; i++) {
             if (vkCreateSemaphore(device, &semaphoreInfo, nullptr, &imageAvailableSemaphores[i]) != VK_SUCCESS || vkCreateSemaphore(device, &semaphoreInfo, nullptr, &renderFinishedSemaphores[i]) || vkCreateFence(device, &fenceInfo, nullptr, &inFlightFences[i]) != VK_SUCCESS) {
                 throw std::runtime_error("ERROR! Failed to create synchronization objects for a frame!");
             }
         }
     }
 
+    /* Block until the GPU has finished the frame that signaled the given timeline value. Because frames finish in
+    order, this also means every earlier frame is done. Anything that needs to wait on a specific frame (uploads,
+    readbacks, ...) can use this instead of its own fence.*/
+    void waitForFrame(uint64_t frameValue) {
+        // Skip the call entirely if we already know the GPU got there.
+        if (frameValue <= lastCompletedFrameValue) {
+            return;
+        }
+
+        VkSemaphoreWaitInfoKHR waitInfo{};
+        waitInfo.sType = VK_STRUCTURE_TYPE_SEMAPHORE_WAIT_INFO_KHR;
+        waitInfo.semaphoreCount = 1;
+        waitInfo.pSemaphores = &frameTimelineSemaphore;
+        waitInfo.pValues = &frameValue;
+
+        Clock::time_point waitStart = Clock::now();
+        if (waitSemaphoresKHR(device, &waitInfo, UINT64_MAX) != VK_SUCCESS) {
+            throw std::runtime_error("ERROR! Failed to wait on frame timeline semaphore!");
+        }
+        frameFenceWaitMs += elapsedMilliseconds(waitStart, Clock::now());
+        lastCompletedFrameValue = frameValue;
+    }
+
+    // Returns the value of the latest frame the GPU has finished, without blocking.
+    uint64_t getCompletedFrameValue() {
+        if (timelineSemaphoresEnabled) {
+            uint64_t value = 0;
+            if (getSemaphoreCounterValueKHR(device, frameTimelineSemaphore, &value) == VK_SUCCESS) {
+                lastCompletedFrameValue = std::max(lastCompletedFrameValue, value);
+            }
+            return lastCompletedFrameValue;
+        }
+
+        // Without a timeline, check the fences. A fence signaled by vkQueueSubmit also covers everything submitted earlier to the same queue, so the newest signaled frame means every frame before it is done too.
+        for (uint32_t i = 0; i < frameSlotCount; i++) {
+            if (frameTimelineValues[i] > lastCompletedFrameValue && vkGetFenceStatus(device, inFlightFences[i]) == VK_SUCCESS) {
+                lastCompletedFrameValue = frameTimelineValues[i];
+            }
+        }
+        return lastCompletedFrameValue;
+    }
+
+    // Destroy an object once every frame submitted so far has finished on the GPU.
+    void deferDestroy(std::function<void()> destroy) {
+        deferredDeletions.push_back({ lastSubmittedFrameValue, std::move(destroy) });
+    }
+
+    // Destroy the deferred objects whose frames are done. The queue is in submission order, so stop at the first one that isn't.
+    void destroyCompletedDeferredDeletions() {
+        if (deferredDeletions.empty()) {
+            return;
+        }
+        uint64_t completedFrameValue = getCompletedFrameValue();
+        while (!deferredDeletions.empty() && deferredDeletions.front().frameValue <= completedFrameValue) {
+            deferredDeletions.front().destroy();
+            deferredDeletions.pop_front();
+        }
+    }
+
+    // Destroy all deferred objects. Only call this once the device is idle.
+    void flushDeferredDeletions() {
+        while (!deferredDeletions.empty()) {
+            deferredDeletions.front().destroy();
+            deferredDeletions.pop_front();
+        }
+    }
+
+    /* Change how many frames can be in flight. Only the first framesInFlight sync objects are used, so this just changes
+    which one comes next. Frames that were submitted from a slot that is no longer used don't need any special handling:
+    their fences/timeline values still get waited on before their swap chain image is reused.*/
+    void setFramesInFlight(uint32_t newFramesInFlight) {
+        if (newFramesInFlight == framesInFlight) {
+            return;
+        }
+        framesInFlight = newFramesInFlight;
+        currentFrame = currentFrame % framesInFlight;
+    }
+
     // Get image from swap chain, exec the command buffer with that image, and return the image to the swap chain for presentation
     void drawFrame() {
         // 0) Wait for the previous frame to be finished and for it to signal the fence before continuing. This can happen if this func is called before the command buffer finishes executing for a frame and the currentFrame hasn't been updated at the end of the func yet.
 
         // Takes an array of fences and waits for either or all of them to be signaled before returning. VK_TRUE means wait for all, but we're only passing in a single fence. Disable the timeout with UINT64_MAX
-        vkWaitForFences(device, 1, &inFlightFences[currentFrame], VK_TRUE, UINT64_MAX);
+        // With timeline semaphores, just wait for the value the last frame submitted from this slot will signal (frame N - framesInFlight).
+        {
+            PROFILE_ZONE("waitForFrameSlot");
+            if (timelineSemaphoresEnabled) {
+                waitForFrame(frameTimelineValues[currentFrame]);
+            }
+            else {
+                waitForFence(inFlightFences[currentFrame]);
+            }
+        }
+        // The frame that last used this fence is done, so its GPU timestamps can be read back without waiting.
+        if (timestampQueryPool != VK_NULL_HANDLE) {
+            collectGpuTimestamps(currentFrame);
+        }
+        // Retire whatever an earlier swap chain recreation left behind, now that more frames are done.
+        destroyCompletedDeferredDeletions();
 
         // 1) Acquire image from swap chain. 
 
         // The third param is the timeout in ns for an image to become available. Using the max value of 64 bit unsigned int disables the timeout. The 4th and 5th params are for semaphores and fences. The last param refers to a variable to output the index of a VkImage in the swapChainImages array. This helps with picking the right command buffer.
         uint32_t imageIndex;
-        vkAcquireNextImageKHR(device, swapChain, UINT64_MAX, imageAvailableSemaphores[currentFrame], VK_NULL_HANDLE, &imageIndex);
+        // In headless mode there is no swap chain to acquire from, so just cycle through the offscreen images.
+        if (settings.headless) {
+            imageIndex = nextOffscreenImage;
+            nextOffscreenImage = (nextOffscreenImage + 1) % static_cast<uint32_t>(swapChainImages.size());
+        }
+        else {
+            PROFILE_ZONE("acquire");
+            VkResult result = vkAcquireNextImageKHR(device, swapChain, UINT64_MAX, imageAvailableSemaphores[currentFrame], VK_NULL_HANDLE, &imageIndex);
+            // The swap chain can't be used anymore (ie the window was resized), so recreate it and try again next frame. Nothing was submitted and the fence wasn't reset, so this frame slot is still good to use.
+            // VK_SUBOPTIMAL_KHR still acquired an image and signaled the semaphore, so that frame is drawn and presented, and the swap chain is recreated after presenting.
+            if (result == VK_ERROR_OUT_OF_DATE_KHR) {
+                recreateSwapChain();
+                return;
+            }
+            else if (result != VK_SUCCESS && result != VK_SUBOPTIMAL_KHR) {
+                throw std::runtime_error("ERROR! Failed to acquire swap chain image!");
+            }
+        }
 
-        // 1.5) Check if a previous frame is rendering to this swap chain image already
-        if (imagesInFlight[imageIndex] != VK_NULL_HANDLE) {
-            vkWaitForFences(device, 1, &imagesInFlight[imageIndex], VK_TRUE, UINT64_MAX);
+        // 1.5) Check if a previous frame is rendering to this swap chain image already. With timeline semaphores this is just waiting on the value of the last frame that used the image.
+        const uint64_t frameValue = lastSubmittedFrameValue + 1;
+        {
+            PROFILE_ZONE("waitForImage");
+            if (timelineSemaphoresEnabled) {
+                waitForFrame(imageTimelineValues[imageIndex]);
+                imageTimelineValues[imageIndex] = frameValue;
+            }
+            else if (imagesInFlight[imageIndex] != VK_NULL_HANDLE) {
+                waitForFence(imagesInFlight[imageIndex]);
+            }
+        }
+        frameTimelineValues[currentFrame] = frameValue;
+        // This frame's queries were read back above, so they can be written again.
+        if (timestampQueryPool != VK_NULL_HANDLE) {
+            timestampQueries[currentFrame] = { true, frameCounter };
         }
         // Mark this swap chain image as being in use by this frame by using the same fence that the inFlightFences uses.
-        imagesInFlight[imageIndex] = inFlightFences[currentFrame];
+        if (!timelineSemaphoresEnabled) {
+            imagesInFlight[imageIndex] = inFlightFences[currentFrame];
+        }
+
 
+        // 2) Record the command buffer. The last frame that used this frame's pool is done (we waited on it above), so reset the whole pool, which puts its command buffer back in the initial state, and record the frame from scratch.
+        if (vkResetCommandPool(device, frameCommandPools[currentFrame], 0) != VK_SUCCESS) {
+            throw std::runtime_error("ERROR! Failed to reset command pool!");
+        }
+        recordCommandBuffer(commandBuffers[currentFrame], imageIndex, currentFrame);
 
-        // 2) Specify and submit the command buffer
+        // 3) Specify and submit the command buffer
         VkSubmitInfo submitInfo{};
         submitInfo.sType                    = VK_STRUCTURE_TYPE_SUBMIT_INFO;
         // First 3 params specify which sems to wait on before exec begins and which stages of the pipeline to wait. We want to wait with writing colors to the image until it's ready, so we specify the stage of the pipeline that writes to the color attachment. Each entry in waitStages corresponds to the sem with same index in pWaitSemaphores.
         VkSemaphore waitSemaphores[]        = { imageAvailableSemaphores[currentFrame] };
         VkPipelineStageFlags waitStages[]   = { VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT };
-        submitInfo.waitSemaphoreCount       = 1;
+        // Nothing was acquired in headless mode, so there is nothing to wait on.
+        submitInfo.waitSemaphoreCount       = settings.headless ? 0 : 1;
         submitInfo.pWaitSemaphores          = waitSemaphores;
         submitInfo.pWaitDstStageMask        = waitStages;
         // Specify which command bufs to actually submit for execution. We want to submit the command buf that binds the swap chain image we just got as color attachment.
         submitInfo.commandBufferCount = 1;
-        submitInfo.pCommandBuffers = &commandBuffers[imageIndex];
+        submitInfo.pCommandBuffers = &commandBuffers[currentFrame];
         // Specify which sem to signal once the command bufs have finished.
         VkSemaphore signalSemaphores[] = { renderFinishedSemaphores[currentFrame] };
-        submitInfo.signalSemaphoreCount = 1;
+        // Nothing will be presented in headless mode, so nothing needs to be signaled.
+        submitInfo.signalSemaphoreCount = settings.headless ? 0 : 1;
         submitInfo.pSignalSemaphores = signalSemaphores;
 
-        // Unlike semaphores, must manually restore fence to unsignaled state.
-        vkResetFences(device, 1, &inFlightFences[currentFrame]);
+        // With timeline semaphores, also signal the frame's value on the timeline semaphore. The values for the binary semaphores are ignored, but the arrays have to line up with pWaitSemaphores/pSignalSemaphores.
+        VkSemaphore timelineSignalSemaphores[] = { renderFinishedSemaphores[currentFrame], frameTimelineSemaphore };
+        uint64_t waitValues[] = { 0 };
+        uint64_t signalValues[] = { 0, frameValue };
+        VkTimelineSemaphoreSubmitInfoKHR timelineSubmitInfo{};
+        VkFence submitFence = VK_NULL_HANDLE;
+        if (timelineSemaphoresEnabled) {
+            // Headless mode doesn't signal renderFinished, so only the timeline semaphore (the last entry) is signaled.
+            const uint32_t firstSignal = settings.headless ? 1 : 0;
+            submitInfo.signalSemaphoreCount = 2 - firstSignal;
+            submitInfo.pSignalSemaphores = timelineSignalSemaphores + firstSignal;
+
+            timelineSubmitInfo.sType = VK_STRUCTURE_TYPE_TIMELINE_SEMAPHORE_SUBMIT_INFO_KHR;
+            timelineSubmitInfo.waitSemaphoreValueCount = submitInfo.waitSemaphoreCount;
+            timelineSubmitInfo.pWaitSemaphoreValues = waitValues;
+            timelineSubmitInfo.signalSemaphoreValueCount = submitInfo.signalSemaphoreCount;
+            timelineSubmitInfo.pSignalSemaphoreValues = signalValues + firstSignal;
+            submitInfo.pNext = &timelineSubmitInfo;
+        }
+        else {
+            // Unlike semaphores, must manually restore fence to unsignaled state.
+            vkResetFences(device, 1, &inFlightFences[currentFrame]);
+            submitFence = inFlightFences[currentFrame];
+        }
 
         // Then, submit the command buffer. Semaphore and fence will be signaled when command buffer finishes executing.
-        if (vkQueueSubmit(graphicsQueue, 1, &submitInfo, inFlightFences[currentFrame]) != VK_SUCCESS) {
-            throw std::runtime_error("ERROR! Failed to submit draw command buffer!");
+        {
+            PROFILE_ZONE("submit");
+            if (vkQueueSubmit(graphicsQueue, 1, &submitInfo, submitFence) != VK_SUCCESS) {
+                throw std::runtime_error("ERROR! Failed to submit draw command buffer!");
+            }
         }
+        lastSubmittedFrameValue = frameValue;
         
-        // 3) Submit the result back to the swap chain and have it eventually show up on the screen.
-        VkPresentInfoKHR presentInfo{};
-        presentInfo.sType               = VK_STRUCTURE_TYPE_PRESENT_INFO_KHR;
-        // Specify which sempahores to wait on before presentation can happen.
-        presentInfo.waitSemaphoreCount  = 1;
-        presentInfo.pWaitSemaphores     = signalSemaphores;
-        // Specify the swap chains to present images to and the index of the image for each swap chain
-        VkSwapchainKHR swapChains[]     = { swapChain };
-        presentInfo.swapchainCount      = 1;
-        presentInfo.pSwapchains         = swapChains;
-        presentInfo.pImageIndices       = &imageIndex;
-        // Allows you to specify an array of VkResult values to check for every individual swap chain if presentation was successful. Not necessary if using 1 swap chain b/c you can just check the return val of the present func.
-        presentInfo.pResults            = nullptr;      // Optional
-
-        // FINALLY! Submit the request to present an image to the swap chain.
-        vkQueuePresentKHR(presentationQueue, &presentInfo);
+        // 4) Submit the result back to the swap chain and have it eventually show up on the screen. Offscreen images stay where they are.
+        if (!settings.headless) {
+            VkPresentInfoKHR presentInfo{};
+            presentInfo.sType               = VK_STRUCTURE_TYPE_PRESENT_INFO_KHR;
+            // Specify which sempahores to wait on before presentation can happen.
+            presentInfo.waitSemaphoreCount  = 1;
+            presentInfo.pWaitSemaphores     = signalSemaphores;
+            // Specify the swap chains to present images to and the index of the image for each swap chain
+            VkSwapchainKHR swapChains[]     = { swapChain };
+            presentInfo.swapchainCount      = 1;
+            presentInfo.pSwapchains         = swapChains;
+            presentInfo.pImageIndices       = &imageIndex;
+            // Allows you to specify an array of VkResult values to check for every individual swap chain if presentation was successful. Not necessary if using 1 swap chain b/c you can just check the return val of the present func.
+            presentInfo.pResults            = nullptr;      // Optional
+
+            // FINALLY! Submit the request to present an image to the swap chain.
+            VkResult result;
+            {
+                PROFILE_ZONE("present");
+                result = vkQueuePresentKHR(presentationQueue, &presentInfo);
+            }
+
+            // Recreate the swap chain if it's out of date or suboptimal, or if the window was resized. This is done after presenting so the semaphores are all in the right state.
+            if (result == VK_ERROR_OUT_OF_DATE_KHR || result == VK_SUBOPTIMAL_KHR || framebufferResized) {
+                recreateSwapChain();
+            }
+            else if (result != VK_SUCCESS) {
+                throw std::runtime_error("ERROR! Failed to present swap chain image!");
+            }
+        }
 
         // Advance to the next frame.
-        currentFrame = (currentFrame + 1) % MAX_FRAMES_IN_FLIGHT;
+        currentFrame = (currentFrame + 1) % framesInFlight;
     }
 
     // ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
 
 };
 
-int main() {
-    HelloTriangleApplication app;
+// Print the available command line options.
+static void printUsage(const char* programName) {
+    const AppSettings defaults;
+    std::cout << "Usage: " << programName << " [options]\n"
+        << "  --headless                  Render into offscreen images without a window, surface or swap chain.\n"
+        << "  --frames <N>                Number of frames to render in headless mode (default " << defaults.headlessFrameCount << ").\n"
+        << "  --benchmark                 Render warm-up frames, then measured frames, and report frame timings as JSON.\n"
+        << "  --warmup-frames <N>         Unmeasured frames at the start of a benchmark (default " << defaults.warmupFrames << ").\n"
+        << "  --benchmark-frames <N>      Measured frames in a benchmark (default " << defaults.benchmarkFrames << ").\n"
+        << "  --benchmark-output <path>   Write the benchmark JSON to a file instead of stdout.\n"
+        << "  --frames-in-flight <N|auto> How many frames the CPU can get ahead of the GPU, 1-" << MAX_FRAMES_IN_FLIGHT << " (default " << defaults.framesInFlight << ").\n"
+        << "                              auto picks the smallest that keeps the GPU busy, up to " << MAX_ADAPTIVE_FRAMES_IN_FLIGHT << ".\n"
+        << "  --timeline-semaphores       Pace frames with a timeline semaphore instead of fences (if supported).\n"
+        << "  --pipeline-libraries        Fast-link pipelines from VK_EXT_graphics_pipeline_library parts and optimize them in the\n"
+        << "                              background (if supported).\n"
+        << "  --shader-objects            Draw with VK_EXT_shader_object shaders and dynamic state instead of pipelines (if supported).\n"
+        << "  --record-threads <N|auto>   Record draws into secondary command buffers on N worker threads (default " << defaults.recordThreads << ", on the main thread).\n"
+        << "                              auto uses one per hardware thread.\n"
+        << "  --compile-threads <N>       Threads that compile pipelines (default: one per hardware thread).\n"
+        << "  --draws <N>                 Draw calls recorded per frame (default " << defaults.drawCount << ").\n"
+        << "  --pipeline-cache <path>     File to load/save the pipeline cache (default " << defaults.pipelineCachePath << ").\n"
+        << "  --no-pipeline-cache         Don't load or save the pipeline cache.\n"
+        << "  --shader-pack <path>        Load the shaders from a shader pack (shaders/pack_shaders.py) instead of the .spv files.\n"
+        << "  --compile-shaders           Compile the GLSL shaders in shaders/ at startup (builds with ENABLE_SHADERC only).\n"
+        << "  --define <NAME[=VALUE]>     Preprocessor definition for --compile-shaders. Can be repeated.\n"
+        << "  --specialize <stage:id=val> Set specialization constant id of the vert or frag shader to val (bool, int, uint or float,\n"
+        << "                              whatever the shader declares). Can be repeated.\n"
+        << "  --shader-cache <dir>        Where compiled shaders are cached (default " << defaults.shaderCacheDir << "). Empty disables the cache.\n"
+        << "  --hot-reload                Rebuild the pipeline when the shaders in shaders/ change (Linux only).\n"
+        << "  --startup-report            Print how long each startup step took, slowest first.\n"
+        << "  --startup-budget <name=ms>  Fail if the named startup step (or \"total\") takes longer than ms. Can be repeated.\n"
+        << "  --trace <path>              Write a Chrome trace (chrome://tracing, Perfetto) of startup and frame phases to a file.\n"
+        << "  --help                      Show this message.\n";
+}
+
+// Parses text as a whole uint32_t. Returns false for anything else, including "-3" (which stoull wraps around), "10abc" and values that don't fit.
+static bool parseUint32(const std::string& text, uint32_t& value) {
+    if (text.find('-') != std::string::npos) {
+        return false;
+    }
+    try {
+        size_t parsed = 0;
+        unsigned long long number = std::stoull(text, &parsed);
+        if (parsed != text.size() || number > UINT32_MAX) {
+            return false;
+        }
+        value = static_cast<uint32_t>(number);
+        return true;
+    }
+    catch (const std::logic_error&) {
+        return false;
+    }
+}
+
+// Reads an unsigned integer argument that follows an option, ie the 500 in "--frames 500".
+static uint32_t parseUnsignedArgument(int argc, char* argv[], int& i) {
+    if (i + 1 >= argc) {
+        throw std::runtime_error(std::string("ERROR! Missing value for ") + argv[i]);
+    }
+    const std::string option = argv[i++];
+    const std::string value = argv[i];
+    uint32_t number = 0;
+    if (!parseUint32(value, number)) {
+        throw std::runtime_error("ERROR! Invalid value '" + value + "' for " + option);
+    }
+    return number;
+}
+
+// Reads a string argument that follows an option, ie the path in "--benchmark-output results.json".
+static std::string parseStringArgument(int argc, char* argv[], int& i) {
+    if (i + 1 >= argc) {
+        throw std::runtime_error(std::string("ERROR! Missing value for ") + argv[i]);
+    }
+    return argv[++i];
+}
+
+// Fill in the AppSettings struct from the command line arguments.
+static AppSettings parseCommandLine(int argc, char* argv[]) {
+    AppSettings settings;
+    for (int i = 1; i < argc; i++) {
+        const std::string arg = argv[i];
+        if (arg == "--headless") {
+            settings.headless = true;
+        }
+        else if (arg == "--frames") {
+            settings.headlessFrameCount = parseUnsignedArgument(argc, argv, i);
+        }
+        else if (arg == "--benchmark") {
+            settings.benchmark = true;
+        }
+        else if (arg == "--warmup-frames") {
+            settings.warmupFrames = parseUnsignedArgument(argc, argv, i);
+        }
+        else if (arg == "--benchmark-frames") {
+            settings.benchmarkFrames = parseUnsignedArgument(argc, argv, i);
+        }
+        else if (arg == "--benchmark-output") {
+            settings.benchmarkOutputPath = parseStringArgument(argc, argv, i);
+        }
+        else if (arg == "--frames-in-flight") {
+            if (i + 1 < argc && std::string(argv[i + 1]) == "auto") {
+                settings.adaptiveFramesInFlight = true;
+                settings.framesInFlight = DEFAULT_FRAMES_IN_FLIGHT;
+                i++;
+            }
+            else {
+                settings.adaptiveFramesInFlight = false;
+                settings.framesInFlight = parseUnsignedArgument(argc, argv, i);
+                if (settings.framesInFlight < 1 || settings.framesInFlight > MAX_FRAMES_IN_FLIGHT) {
+                    throw std::runtime_error("ERROR! --frames-in-flight must be between 1 and " + std::to_string(MAX_FRAMES_IN_FLIGHT));
+                }
+            }
+        }
+        else if (arg == "--record-threads") {
+            if (i + 1 < argc && std::string(argv[i + 1]) == "auto") {
+                settings.recordThreads = std::max(1u, std::thread::hardware_concurrency());
+                i++;
+            }
+            else {
+                settings.recordThreads = parseUnsignedArgument(argc, argv, i);
+            }
+        }
+        else if (arg == "--compile-threads") {
+            settings.compileThreads = parseUnsignedArgument(argc, argv, i);
+        }
+        else if (arg == "--draws") {
+            settings.drawCount = parseUnsignedArgument(argc, argv, i);
+            if (settings.drawCount == 0) {
+                throw std::runtime_error("ERROR! --draws must be at least 1");
+            }
+        }
+        else if (arg == "--shader-pack") {
+            settings.shaderPackPath = parseStringArgument(argc, argv, i);
+        }
+        else if (arg == "--compile-shaders") {
+#ifndef ENABLE_SHADERC
+            throw std::runtime_error("ERROR! --compile-shaders needs a build with ENABLE_SHADERC defined!");
+#endif
+            settings.compileShaders = true;
+        }
+        else if (arg == "--define") {
+            settings.shaderDefines.push_back(parseStringArgument(argc, argv, i));
+        }
+        else if (arg == "--specialize") {
+            std::string specialization = parseStringArgument(argc, argv, i);
+            size_t colon = specialization.find(':');
+            size_t equals = specialization.find('=');
+            std::string stage = specialization.substr(0, colon);
+            if (colon == std::string::npos || equals == std::string::npos || equals < colon || (stage != "vert" && stage != "frag")) {
+                throw std::runtime_error("ERROR! --specialize expects <vert|frag>:<id>=<value>, got " + specialization);
+            }
+            AppSettings::Specialization setting;
+            setting.stage = stage == "vert" ? VK_SHADER_STAGE_VERTEX_BIT : VK_SHADER_STAGE_FRAGMENT_BIT;
+            if (!parseUint32(specialization.substr(colon + 1, equals - colon - 1), setting.constantId)) {
+                throw std::runtime_error("ERROR! --specialize expects <vert|frag>:<id>=<value>, got " + specialization);
+            }
+            setting.value = specialization.substr(equals + 1);
+            settings.specializations.push_back(setting);
+        }
+        else if (arg == "--shader-cache") {
+            settings.shaderCacheDir = parseStringArgument(argc, argv, i);
+        }
+        else if (arg == "--hot-reload") {
+            settings.hotReload = true;
+        }
+        else if (arg == "--startup-report") {
+            settings.startupReport = true;
+        }
+        else if (arg == "--startup-budget") {
+            const std::string budget = parseStringArgument(argc, argv, i);
+            size_t separator = budget.rfind('=');
+            double ms = -1.0;
+            if (separator != std::string::npos && separator > 0) {
+                try {
+                    ms = std::stod(budget.substr(separator + 1));
+                }
+                catch (const std::exception&) {
+                    ms = -1.0;
+                }
+            }
+            if (ms < 0.0) {
+                throw std::runtime_error("ERROR! --startup-budget expects <name>=<milliseconds>, got " + budget);
+            }
+            settings.startupBudgets.emplace_back(budget.substr(0, separator), ms);
+        }
+        else if (arg == "--trace") {
+            settings.tracePath = parseStringArgument(argc, argv, i);
+        }
+        else if (arg == "--timeline-semaphores") {
+            settings.timelineSemaphores = true;
+        }
+        else if (arg == "--pipeline-libraries") {
+            settings.pipelineLibraries = true;
+        }
+        else if (arg == "--shader-objects") {
+            settings.shaderObjects = true;
+        }
+        else if (arg == "--pipeline-cache") {
+            settings.pipelineCachePath = parseStringArgument(argc, argv, i);
+        }
+        else if (arg == "--no-pipeline-cache") {
+            settings.pipelineCachePath.clear();
+        }
+        else if (arg == "--help") {
+            printUsage(argv[0]);
+            std::exit(EXIT_SUCCESS);
+        }
+        else {
+            printUsage(argv[0]);
+            throw std::runtime_error("ERROR! Unknown option " + arg);
+        }
+    }
+    return settings;
+}
 
+int main(int argc, char* argv[]) {
     // If any kind of fatal error occurs, we'll throw a std::runtime_error and propagate the message to the main function and printed to command prompt.
     // Also, catch more general std::exception errors
     try {
+        AppSettings settings = parseCommandLine(argc, argv);
+        if (!settings.tracePath.empty()) {
+            Profiler::enable();
+            Profiler::setThreadName("Main thread");
+        }
+
+        /* Without --benchmark-output, the benchmark report goes to stdout and has to be the only thing there so it can be
+        parsed. Everything else std::cout is used for (startup messages, etc) is sent to stderr instead.*/
+        std::ostream stdoutStream(std::cout.rdbuf());
+        if (settings.benchmark && settings.benchmarkOutputPath.empty()) {
+            std::cout.rdbuf(std::cerr.rdbuf());
+        }
+
+        HelloTriangleApplication app(settings, stdoutStream);
         app.run();
+
+        if (!settings.tracePath.empty()) {
+            if (!Profiler::writeChromeTrace(settings.tracePath)) {
+                throw std::runtime_error("ERROR! Failed to write trace to " + settings.tracePath);
+            }
+            std::cout << "Trace written to " << settings.tracePath << "\n";
+        }
     }
     catch (const std::exception& e) {
         std::cerr << e.what() << std::endl;
@@ -1,3 +1,6 @@
 C:/VulkanSDK/1.2.162.0/Bin32/glslc.exe shader.vert -o vert.spv
 C:/VulkanSDK/1.2.162.0/Bin32/glslc.exe shader.frag -o frag.spv
+C:/VulkanSDK/1.2.162.0/Bin32/glslc.exe shader.vert -mfmt=num -o vert.spv.inc
+C:/VulkanSDK/1.2.162.0/Bin32/glslc.exe shader.frag -mfmt=num -o frag.spv.inc
+python pack_shaders.py shaders.pack shader.vert=vert.spv shader.frag=frag.spv
 pause
\ No newline at end of file
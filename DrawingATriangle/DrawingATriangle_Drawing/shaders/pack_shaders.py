@@ -0,0 +1,86 @@
+# Packs SPIR-V files into a single shader pack that main.cpp can memory-map (see ShaderPack in main.cpp).
+#
+# Usage: python pack_shaders.py <output.pack> <name>=<file.spv> [<name>=<file.spv> ...]
+# The stage of each shader comes from the extension of its name (ie shader.vert is a vertex shader).
+#
+# Layout (all integers little-endian):
+#   header:  magic "SPAK", uint32 version, uint32 entryCount, uint32 reserved
+#   entries: entryCount x { char name[64], uint32 stage (VkShaderStageFlagBits), uint32 reserved,
+#                           uint64 hash (FNV-1a 64 of the SPIR-V), uint64 offset, uint64 size }, sorted by name
+#   data:    the SPIR-V of each entry, each starting at a 16 byte aligned offset
+import struct
+import sys
+
+MAGIC = b"SPAK"
+VERSION = 1
+NAME_SIZE = 64
+HEADER_FORMAT = "<4sIII"
+ENTRY_FORMAT = "<%dsIIQQQ" % NAME_SIZE
+DATA_ALIGNMENT = 16
+
+# VkShaderStageFlagBits
+STAGES = {
+    "vert": 0x01,
+    "tesc": 0x02,
+    "tese": 0x04,
+    "geom": 0x08,
+    "frag": 0x10,
+    "comp": 0x20,
+}
+
+
+def fnv1a64(data):
+    value = 0xcbf29ce484222325
+    for byte in data:
+        value ^= byte
+        value = (value * 0x100000001b3) & 0xffffffffffffffff
+    return value
+
+
+def align(value, alignment):
+    return (value + alignment - 1) // alignment * alignment
+
+
+def main(argv):
+    if len(argv) < 3:
+        print("Usage: python pack_shaders.py <output.pack> <name>=<file.spv> [<name>=<file.spv> ...]")
+        return 1
+
+    shaders = []
+    for arg in argv[2:]:
+        name, _, path = arg.partition("=")
+        stage = STAGES.get(name.rsplit(".", 1)[-1])
+        if not path or stage is None:
+            print("ERROR! Expected <name>.<stage>=<file.spv>, got " + arg)
+            return 1
+        if len(name.encode()) >= NAME_SIZE:
+            print("ERROR! Shader name is too long: " + name)
+            return 1
+        with open(path, "rb") as f:
+            code = f.read()
+        if len(code) == 0 or len(code) % 4 != 0:
+            print("ERROR! " + path + " is not SPIR-V")
+            return 1
+        shaders.append((name, stage, code))
+    shaders.sort(key=lambda shader: shader[0])
+
+    offset = align(struct.calcsize(HEADER_FORMAT) + len(shaders) * struct.calcsize(ENTRY_FORMAT), DATA_ALIGNMENT)
+    entries = b""
+    data = b""
+    for name, stage, code in shaders:
+        entries += struct.pack(ENTRY_FORMAT, name.encode(), stage, 0, fnv1a64(code), offset, len(code))
+        padded = code + b"\0" * (align(len(code), DATA_ALIGNMENT) - len(code))
+        data += padded
+        offset += len(padded)
+
+    header = struct.pack(HEADER_FORMAT, MAGIC, VERSION, len(shaders), 0)
+    table = header + entries
+    table += b"\0" * (align(len(table), DATA_ALIGNMENT) - len(table))
+    with open(argv[1], "wb") as f:
+        f.write(table + data)
+    print("Packed %d shaders into %s" % (len(shaders), argv[1]))
+    return 0
+
+
+if __name__ == "__main__":
+    sys.exit(main(sys.argv))
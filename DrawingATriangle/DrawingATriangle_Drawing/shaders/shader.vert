@@ -1,29 +1,18 @@
 #version 450
 #extension GL_ARB_separate_shader_objects : enable
 
+// The vertex attributes, read from the vertex buffer. The locations are the order they're interleaved in each vertex (see Vertex in main.cpp).
+layout(location = 0) in vec2 inPosition;
+layout(location = 1) in vec3 inColor;
+
 // Need to specify the index of the framebuffer to communicate with the fragment shader.
 layout(location = 0) out vec3 fragColor;
 
-// For the tutorial, hard-code the positions so we don't need to create a vertex buffer (yet).
-vec2 positions[3] = vec2[](
-	vec2(0.0, -0.5), // Top vertex (v0)	
-	vec2(0.5, 0.5),  // Bottom right vertex (v1)
-	vec2(-0.5, 0.5)  // Bottom left vertex  (v2)
-);
-
-// Give a color for each position
-vec3 colors[3] = vec3[](
-	vec3(1.0, 0.0, 0.0),  // v0 is red 
-	vec3(0.0, 1.0, 0.0), //  v1 is green 
-	vec3(0.0, 0.0, 1.0) //   v2 is blue
-);
-
-/* Invoked for every vertex. The built-in gl_VertexIndex variable contains the index of the current vertex,
-   This is usually an index into the vertex buffer, but in this example it is an index into the hardcoded array
-   of vertex data. 
+/* Invoked for every vertex. The attributes of the current vertex are fetched from the vertex buffer by Vulkan,
+   using the index from the index buffer.
 */
 void main() {
-	// The position of each vertex is accessed from the hardcoded array and combined with dummy z & w components to produce a position in clip coords.
-	gl_Position = vec4(positions[gl_VertexIndex], 0.0, 1.0);
-	fragColor = colors[gl_VertexIndex];
-}
\ No newline at end of file
+	// The position comes from the vertex buffer and is combined with dummy z & w components to produce a position in clip coords.
+	gl_Position = vec4(inPosition, 0.0, 1.0);
+	fragColor = inColor;
+}